@@ -0,0 +1,493 @@
+#include <dcpu-batch.h>
+#include <dcpu-engine-specialized.h>
+#include <algorithm>
+
+namespace {
+    // lane registers, in the order of the structure of arrays
+    enum Slot : byte_t {
+        Slot_SP = Registers_Count,
+        Slot_EX,
+
+        Slot_Count,
+        Slot_None = Slot_Count,
+    };
+
+    byte_t GetSlot(OperandKind kind, byte_t reg) {
+        switch (kind) {
+        case OperandKind_Register: return reg;
+        case OperandKind_SP: return Slot_SP;
+        case OperandKind_EX: return Slot_EX;
+        default: return Slot_None;
+        }
+    }
+
+    bool IsMemoryOperand(OperandKind kind) {
+        switch (kind) {
+        case OperandKind_Ref: case OperandKind_RefNext: case OperandKind_Peek:
+        case OperandKind_Pick: case OperandKind_Next:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    bool IsLaneOpCode(OpCode op) {
+        switch (op) {
+        case OpCode_SET: case OpCode_ADD: case OpCode_SUB: case OpCode_MUL:
+        case OpCode_MLI: case OpCode_AND: case OpCode_BOR: case OpCode_XOR:
+        case OpCode_SHR: case OpCode_ASR: case OpCode_SHL: case OpCode_ADX:
+        case OpCode_SBX:
+            return true;
+        default:
+            return isConditionalOpCode(op);
+        }
+    }
+
+    bool WritesEX(OpCode op) {
+        return overwritesEX(op) || op == OpCode_ADX || op == OpCode_SBX;
+    }
+}
+
+struct LockstepBatch::Lanes {
+    alignas(32) word_t m_slots[Slot_Count][LaneCount] = {};
+    DCPU* m_cpus[LaneCount] = {};           // nullptr once the lane left the group
+    Memory* m_mems[LaneCount] = {};
+    uint64_t m_synced[LaneCount] = {};      // m_executed as last written to the lane's DCPU
+    long_t m_activeCount = 0;
+    word_t m_pc = 0;
+    cycles_t m_cycles = 0;
+    uint64_t m_executed = 0;                // instructions executed on the lanes
+    long_t m_pcLimit = DCPU::NoPCLimit;
+    bool m_needsStep = false;               // a lane has an interrupt to deliver
+
+    bool isActive(long_t lane) const { return m_cpus[lane] != nullptr; }
+    long_t leader() const {
+        long_t lane = 0;
+        while (!isActive(lane)) {
+            ++lane;
+        }
+        return lane;
+    }
+
+    void syncIn(long_t lane) {
+        const DCPU& cpu = *m_cpus[lane];
+        for (int r=0; r<Registers_Count; ++r) {
+            m_slots[r][lane] = cpu.m_registers[r];
+        }
+        m_slots[Slot_SP][lane] = cpu.m_sp;
+        m_slots[Slot_EX][lane] = cpu.m_ex;
+    }
+
+    void syncOut(long_t lane, word_t pc, cycles_t cycles) {
+        DCPU& cpu = *m_cpus[lane];
+        for (int r=0; r<Registers_Count; ++r) {
+            cpu.m_registers[r] = m_slots[r][lane];
+        }
+        cpu.m_sp = m_slots[Slot_SP][lane];
+        cpu.m_ex = m_slots[Slot_EX][lane];
+        cpu.m_pc = pc;
+        cpu.m_cycles = cycles;
+        cpu.m_instructionCount += m_executed - m_synced[lane];
+        m_synced[lane] = m_executed;
+    }
+
+    word_t address(OperandKind kind, const SpecializedEngine::Operand& operand, long_t lane) const {
+        switch (kind) {
+        case OperandKind_Ref: return m_slots[operand.m_register][lane];
+        case OperandKind_RefNext: return m_slots[operand.m_register][lane] + operand.m_word;
+        case OperandKind_Peek: return m_slots[Slot_SP][lane];
+        case OperandKind_Pick: return m_slots[Slot_SP][lane] + operand.m_word;
+        default: return operand.m_word;
+        }
+    }
+
+    void read(OperandKind kind, const SpecializedEngine::Operand& operand, word_t* outValues) const {
+        const byte_t slot = GetSlot(kind, operand.m_register);
+        if (slot != Slot_None) {
+            std::copy(m_slots[slot], m_slots[slot] + LaneCount, outValues);
+        } else if (IsMemoryOperand(kind)) {
+            for (long_t lane=0; lane<LaneCount; ++lane) {
+                outValues[lane] = isActive(lane) ? (*m_mems[lane])[address(kind, operand, lane)] : 0;
+            }
+        } else {
+            std::fill(outValues, outValues + LaneCount, kind == OperandKind_PC ? m_pc : operand.m_word);
+        }
+    }
+};
+
+struct LockstepBatch::CodeEntry {
+    SpecializedEngine::Entry m_entry;
+    OperandKind m_a = OperandKind_None;
+    OperandKind m_b = OperandKind_None;
+    bool m_isLaneOp = false;
+    uint32_t m_epoch = 0;
+};
+
+// Drops the decoded code of the batch when a lane writes one of the words it
+// was decoded from, the words are watched as they are decoded
+class LockstepBatch::CodeWatch : public MemoryObserver {
+public:
+    explicit CodeWatch(LockstepBatch& batch) : m_batch(batch) {}
+    void onMemoryWrite(word_t addr) override { m_batch.invalidate(); }
+
+private:
+    LockstepBatch& m_batch;
+};
+
+LockstepBatch::LockstepBatch(const vector<word_t>& program, long_t machineCount, TimingMode timing)
+    : m_timing {timing}
+    , m_code(Memory::LastValidAddress+1)
+{
+    for (long_t i=0; i<machineCount; ++i) {
+        m_cpus.push_back(std::make_unique<DCPU>(timing));
+        m_mems.push_back(std::make_unique<Memory>());
+        m_cpus.back()->setPCLimit(m_mems.back()->LoadProgram(program));
+        m_watches.push_back(std::make_unique<CodeWatch>(*this));
+        m_watches.back()->attach(*m_mems.back());
+    }
+}
+
+LockstepBatch::~LockstepBatch() {
+}
+
+vector<StopReason> LockstepBatch::run(cycles_t budget) {
+    const long_t machineCount = getMachineCount();
+    vector<StopReason> reasons(machineCount, StopReason_PCLimit);
+    vector<bool> isDone(machineCount, false);
+    vector<cycles_t> starts(machineCount);
+    for (long_t i=0; i<machineCount; ++i) {
+        starts[i] = m_cpus[i]->getCycles();
+    }
+
+    for (long_t first=0; first<machineCount; first+=LaneCount) {
+        runLanes(first, budget, reasons, isDone);
+    }
+
+    // lanes that left their group, or never joined one
+    for (long_t i=0; i<machineCount; ++i) {
+        if (isDone[i])
+            continue;
+        DCPU& cpu = *m_cpus[i];
+        const uint64_t instructions = cpu.getInstructionCount();
+        do {
+            const cycles_t elapsed = cpu.getCycles() - starts[i];
+            const cycles_t remaining = budget == DCPU::NoCycleBudget
+                ? DCPU::NoCycleBudget
+                : budget - std::min(elapsed, budget);
+            reasons[i] = cpu.runFor(*m_mems[i], remaining);
+        } while (reasons[i] == StopReason_Interrupt);
+        m_stats.m_scalarInstructions += cpu.getInstructionCount() - instructions;
+    }
+    return reasons;
+}
+
+void LockstepBatch::runLanes(long_t first, cycles_t budget, vector<StopReason>& outReasons,
+                             vector<bool>& outIsDone) {
+    Lanes lanes;
+    const long_t laneCount = std::min(LaneCount, getMachineCount() - first);
+    for (long_t lane=0; lane<laneCount; ++lane) {
+        DCPU& cpu = *m_cpus[first + lane];
+        if (!cpu.m_devices.empty() || cpu.m_breakpointCount != 0)
+            continue;
+        if (lanes.m_activeCount == 0) {
+            lanes.m_pc = cpu.m_pc;
+            lanes.m_cycles = cpu.m_cycles;
+            lanes.m_pcLimit = cpu.m_pcLimit;
+        } else if (cpu.m_pc != lanes.m_pc || cpu.m_cycles != lanes.m_cycles || cpu.m_pcLimit != lanes.m_pcLimit) {
+            continue;
+        }
+        lanes.m_cpus[lane] = &cpu;
+        lanes.m_mems[lane] = m_mems[first + lane].get();
+        lanes.m_needsStep = lanes.m_needsStep || cpu.m_isInterruptPending;
+        lanes.syncIn(lane);
+        ++lanes.m_activeCount;
+    }
+    if (lanes.m_activeCount < 2)
+        return; // nothing to share
+
+    // the decoded code comes from another group's memory
+    invalidate();
+    const cycles_t start = lanes.m_cycles;
+    StopReason reason = StopReason_PCLimit;
+    while (lanes.m_activeCount != 0) {
+        if (lanes.m_pc >= lanes.m_pcLimit) {
+            reason = StopReason_PCLimit;
+            break;
+        }
+        if (lanes.m_cycles - start >= budget) {
+            reason = StopReason_Budget;
+            break;
+        }
+        const CodeEntry& code = decode(lanes);
+        if (lanes.m_needsStep || !code.m_isLaneOp) {
+            step(lanes);
+        } else {
+            execute(lanes, code);
+        }
+    }
+
+    for (long_t lane=0; lane<LaneCount; ++lane) {
+        if (lanes.isActive(lane)) {
+            lanes.syncOut(lane, lanes.m_pc, lanes.m_cycles);
+            outReasons[first + lane] = reason;
+            outIsDone[first + lane] = true;
+        }
+    }
+}
+
+const LockstepBatch::CodeEntry& LockstepBatch::decode(Lanes& lanes) {
+    const word_t pc = lanes.m_pc;
+    CodeEntry& code = m_code[pc];
+    if (code.m_epoch == m_epoch)
+        return code;
+
+    const long_t leader = lanes.leader();
+    Memory& mem = *lanes.m_mems[leader];
+    SpecializedEngine::Entry& entry = code.m_entry;
+    SpecializedEngine::Predecode(mem, pc, entry);
+    ++m_stats.m_decodedCount;
+    const Instruction& inst = entry.m_instruction;
+    code.m_a = OperandKind_None;
+    code.m_b = OperandKind_None;
+    if (inst.m_opcode != OpCode_Special && entry.m_cycles != 0) {
+        code.m_a = GetOperandKind(inst.m_a, true, inst.m_wordA, entry.m_a.m_word, entry.m_a.m_register);
+        code.m_b = GetOperandKind(inst.m_b, false, inst.m_wordB, entry.m_b.m_word, entry.m_b.m_register);
+    }
+
+    code.m_isLaneOp = IsLaneOpCode(inst.m_opcode)
+        && code.m_a != OperandKind_None && code.m_a != OperandKind_PushPop
+        && code.m_b != OperandKind_None && code.m_b != OperandKind_PushPop;
+    if (code.m_isLaneOp && !isConditionalOpCode(inst.m_opcode)) {
+        // a is read again after b is written, aliased operands are left to the DCPU
+        const byte_t slotA = GetSlot(code.m_a, entry.m_a.m_register);
+        const byte_t slotB = GetSlot(code.m_b, entry.m_b.m_register);
+        code.m_isLaneOp = !(IsMemoryOperand(code.m_a) && IsMemoryOperand(code.m_b))
+            && (slotA == Slot_None || slotA != slotB)
+            && !(code.m_a == OperandKind_PC && code.m_b == OperandKind_PC);
+    }
+
+    // every lane must hold the same code, skipped instructions included
+    mem.Watch(pc, entry.m_span);
+    for (long_t lane=leader+1; lane<LaneCount; ++lane) {
+        if (!lanes.isActive(lane))
+            continue;
+        Memory& laneMem = *lanes.m_mems[lane];
+        bool isSame = true;
+        for (word_t i=0; i<entry.m_span && isSame; ++i) {
+            const word_t addr = pc + i;
+            isSame = laneMem[addr] == mem[addr];
+        }
+        if (isSame) {
+            laneMem.Watch(pc, entry.m_span);
+        } else {
+            detach(lanes, lane, pc, lanes.m_cycles);
+        }
+    }
+    code.m_epoch = m_epoch;
+    return code;
+}
+
+void LockstepBatch::execute(Lanes& lanes, const CodeEntry& code) {
+    const SpecializedEngine::Entry& entry = code.m_entry;
+    const OpCode op = entry.m_instruction.m_opcode;
+    const cycles_t cycles = m_timing == TimingMode_Functional ? 1 : entry.m_cycles;
+    word_t a[LaneCount];
+    word_t b[LaneCount];
+    lanes.read(code.m_a, entry.m_a, a);
+    lanes.read(code.m_b, entry.m_b, b);
+    ++lanes.m_executed;
+    m_stats.m_lockstepInstructions += lanes.m_activeCount;
+
+    if (isConditionalOpCode(op)) {
+        word_t skip[LaneCount];
+        switch (op) {
+        case OpCode_IFB: for (long_t l=0; l<LaneCount; ++l) skip[l] = (b[l] & a[l]) == 0; break;
+        case OpCode_IFC: for (long_t l=0; l<LaneCount; ++l) skip[l] = (b[l] & a[l]) != 0; break;
+        case OpCode_IFE: for (long_t l=0; l<LaneCount; ++l) skip[l] = b[l] != a[l]; break;
+        case OpCode_IFN: for (long_t l=0; l<LaneCount; ++l) skip[l] = b[l] == a[l]; break;
+        case OpCode_IFG: for (long_t l=0; l<LaneCount; ++l) skip[l] = b[l] <= a[l]; break;
+        case OpCode_IFA:
+            for (long_t l=0; l<LaneCount; ++l)
+                skip[l] = static_cast<signed_word_t>(b[l]) <= static_cast<signed_word_t>(a[l]);
+            break;
+        case OpCode_IFL: for (long_t l=0; l<LaneCount; ++l) skip[l] = b[l] >= a[l]; break;
+        default:
+            for (long_t l=0; l<LaneCount; ++l)
+                skip[l] = static_cast<signed_word_t>(b[l]) >= static_cast<signed_word_t>(a[l]);
+            break;
+        }
+
+        const word_t nextPC = lanes.m_pc + entry.m_wordCount;
+        const cycles_t skipCycles = m_timing == TimingMode_Functional ? 0 : entry.m_skipCycles;
+        word_t pcs[LaneCount];
+        cycles_t laneCycles[LaneCount];
+        for (long_t l=0; l<LaneCount; ++l) {
+            pcs[l] = skip[l] ? entry.m_skipTarget : nextPC;
+            laneCycles[l] = lanes.m_cycles + cycles + (skip[l] ? skipCycles : 0);
+        }
+        regroup(lanes, pcs, laneCycles);
+        return;
+    }
+
+    word_t res[LaneCount];
+    word_t ex[LaneCount];
+    const word_t* exIn = lanes.m_slots[Slot_EX];
+    switch (op) {
+    case OpCode_SET:
+        std::copy(a, a + LaneCount, res);
+        break;
+    case OpCode_ADD:
+        for (long_t l=0; l<LaneCount; ++l) {
+            res[l] = b[l] + a[l];
+            ex[l] = res[l] < a[l] ? 1 : 0;
+        }
+        break;
+    case OpCode_SUB:
+        for (long_t l=0; l<LaneCount; ++l) {
+            res[l] = b[l] - a[l];
+            ex[l] = res[l] > b[l] ? 0xFFFF : 0;
+        }
+        break;
+    case OpCode_MUL:
+    case OpCode_MLI:
+        // MLI is an unsigned multiply in the reference interpreter too
+        for (long_t l=0; l<LaneCount; ++l) {
+            const uint32_t product = static_cast<uint32_t>(b[l]) * a[l];
+            res[l] = static_cast<word_t>(product);
+            ex[l] = static_cast<word_t>(product >> 16);
+        }
+        break;
+    case OpCode_AND: for (long_t l=0; l<LaneCount; ++l) res[l] = b[l] & a[l]; break;
+    case OpCode_BOR: for (long_t l=0; l<LaneCount; ++l) res[l] = b[l] | a[l]; break;
+    case OpCode_XOR: for (long_t l=0; l<LaneCount; ++l) res[l] = b[l] ^ a[l]; break;
+    case OpCode_SHR:
+    case OpCode_ASR:
+    case OpCode_SHL:
+        // shifts of 32 and more move every bit out, the count is kept under
+        // 32 and those lanes cleared
+        for (long_t l=0; l<LaneCount; ++l) {
+            const uint32_t count = std::min<uint32_t>(a[l], 31);
+            const bool isOut = a[l] > 31;
+            const uint64_t bval = b[l];
+            ex[l] = isOut ? 0 : static_cast<word_t>(op == OpCode_SHL ? (bval << count) >> 16 : (bval << 16) >> count);
+            if (op == OpCode_SHR) {
+                res[l] = isOut ? 0 : static_cast<word_t>(bval >> count);
+            } else if (op == OpCode_ASR) {
+                res[l] = static_cast<word_t>(static_cast<int32_t>(static_cast<signed_word_t>(bval)) >> count);
+            } else {
+                res[l] = isOut ? 0 : static_cast<word_t>(bval << count);
+            }
+        }
+        break;
+    case OpCode_ADX:
+        for (long_t l=0; l<LaneCount; ++l) {
+            const uint32_t sum = static_cast<uint32_t>(b[l]) + a[l] + exIn[l];
+            res[l] = static_cast<word_t>(sum);
+            ex[l] = static_cast<word_t>(sum >> 16);
+        }
+        break;
+    default: // OpCode_SBX
+        for (long_t l=0; l<LaneCount; ++l) {
+            res[l] = b[l] - a[l] + exIn[l];
+            ex[l] = res[l] > b[l] ? 0xFFFF : 0;
+        }
+        break;
+    }
+
+    const byte_t slotB = GetSlot(code.m_b, entry.m_b.m_register);
+    if (slotB != Slot_None) {
+        std::copy(res, res + LaneCount, lanes.m_slots[slotB]);
+    } else if (IsMemoryOperand(code.m_b)) {
+        for (long_t l=0; l<LaneCount; ++l) {
+            if (lanes.isActive(l)) {
+                lanes.m_mems[l]->Write(lanes.address(code.m_b, entry.m_b, l), res[l]);
+            }
+        }
+    }
+    if (WritesEX(op)) {
+        std::copy(ex, ex + LaneCount, lanes.m_slots[Slot_EX]);
+    }
+
+    const word_t nextPC = lanes.m_pc + entry.m_wordCount;
+    if (code.m_b == OperandKind_PC) {
+        // pc only moves on when the instruction left it unchanged
+        word_t pcs[LaneCount];
+        cycles_t laneCycles[LaneCount];
+        for (long_t l=0; l<LaneCount; ++l) {
+            pcs[l] = res[l] == lanes.m_pc ? nextPC : res[l];
+            laneCycles[l] = lanes.m_cycles + cycles;
+        }
+        regroup(lanes, pcs, laneCycles);
+    } else {
+        lanes.m_pc = nextPC;
+        lanes.m_cycles += cycles;
+    }
+}
+
+void LockstepBatch::step(Lanes& lanes) {
+    word_t pcs[LaneCount] = {};
+    cycles_t cycles[LaneCount] = {};
+    lanes.m_needsStep = false;
+    for (long_t lane=0; lane<LaneCount; ++lane) {
+        if (!lanes.isActive(lane))
+            continue;
+        DCPU& cpu = *lanes.m_cpus[lane];
+        lanes.syncOut(lane, lanes.m_pc, lanes.m_cycles);
+        cpu.step(*lanes.m_mems[lane]);
+        lanes.syncIn(lane);
+        ++m_stats.m_scalarInstructions;
+        if (cpu.m_isOnFire) {
+            detach(lanes, lane, cpu.m_pc, cpu.m_cycles);   // runFor reports it
+            continue;
+        }
+        pcs[lane] = cpu.m_pc;
+        cycles[lane] = cpu.m_cycles;
+        lanes.m_needsStep = lanes.m_needsStep || cpu.m_isInterruptPending;
+    }
+    regroup(lanes, pcs, cycles);
+}
+
+void LockstepBatch::regroup(Lanes& lanes, const word_t* pcs, const cycles_t* cycles) {
+    // the group follows the most lanes, ties go to the lowest lane
+    long_t best = lanes.leader();
+    long_t bestVotes = 0;
+    for (long_t lane=best; lane<LaneCount && bestVotes*2 <= lanes.m_activeCount; ++lane) {
+        if (!lanes.isActive(lane))
+            continue;
+        long_t votes = 0;
+        for (long_t other=lane; other<LaneCount; ++other) {
+            votes += lanes.isActive(other) && pcs[other] == pcs[lane] && cycles[other] == cycles[lane];
+        }
+        if (votes > bestVotes) {
+            best = lane;
+            bestVotes = votes;
+        }
+    }
+
+    const word_t pc = pcs[best];
+    const cycles_t groupCycles = cycles[best];
+    for (long_t lane=0; lane<LaneCount; ++lane) {
+        if (lanes.isActive(lane) && (pcs[lane] != pc || cycles[lane] != groupCycles)) {
+            detach(lanes, lane, pcs[lane], cycles[lane]);
+        }
+    }
+    lanes.m_pc = pc;
+    lanes.m_cycles = groupCycles;
+}
+
+void LockstepBatch::detach(Lanes& lanes, long_t lane, word_t pc, cycles_t cycles) {
+    lanes.syncOut(lane, pc, cycles);
+    lanes.m_cpus[lane] = nullptr;
+    lanes.m_mems[lane] = nullptr;
+    --lanes.m_activeCount;
+    ++m_stats.m_divergedCount;
+}
+
+void LockstepBatch::invalidate() {
+    if (++m_epoch == 0) {
+        for (CodeEntry& code : m_code) {
+            code.m_epoch = 0;
+        }
+        m_epoch = 1;
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <dcpu.h>
+#include <dcpu-mem.h>
+#include <dcpu-types.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+using std::vector;
+
+struct BatchStats {
+    uint64_t m_lockstepInstructions = 0;    // summed over the lanes executing them
+    uint64_t m_scalarInstructions = 0;      // stepped on a lane's own DCPU or run after leaving
+    size_t m_divergedCount = 0;             // lanes that left their group
+    size_t m_decodedCount = 0;              // instructions decoded for a group, again only once code is written
+};
+
+//
+// Runs many machines loaded with the same program side by side. Machines are
+// packed by groups of LaneCount lanes whose registers are kept as structure
+// of arrays, each instruction is decoded once and applied to every lane with
+// fixed size loops the compiler vectorizes at -O2 (SSE2 unless built with
+// scons native=1), unoptimized builds run them as plain scalar loops. A lane whose pc, cycle
+// count or code stops matching the group's leaves it and finishes on its own
+// DCPU. Special opcodes, stack push/pop, divisions and STI/STD are stepped on
+// each lane's DCPU, machines with devices or breakpoints never join a group.
+// The decoded code is only dropped when a lane stores to a word it came from.
+//
+class LockstepBatch {
+public:
+    static constexpr long_t LaneCount = 16;     // 16 bit words, two SSE2 or one AVX2 register
+
+    LockstepBatch(const vector<word_t>& program, long_t machineCount,
+                  TimingMode timing = TimingMode_CycleAccurate);
+    ~LockstepBatch();
+
+    long_t getMachineCount() const { return static_cast<long_t>(m_cpus.size()); }
+    DCPU& getCPU(long_t index) { return *m_cpus[index]; }
+    Memory& getMemory(long_t index) { return *m_mems[index]; }
+
+    // Same as DCPU::runFor on every machine except that delivered interrupts
+    // do not stop it, returns the stop reason of each machine.
+    vector<StopReason> run(cycles_t budget = DCPU::NoCycleBudget);
+    const BatchStats& getStats() const { return m_stats; }
+
+private:
+    struct Lanes;
+    struct CodeEntry;
+    class CodeWatch;
+
+    void runLanes(long_t first, cycles_t budget, vector<StopReason>& outReasons, vector<bool>& outIsDone);
+    const CodeEntry& decode(Lanes& lanes);
+    void execute(Lanes& lanes, const CodeEntry& code);
+    void step(Lanes& lanes);
+    void regroup(Lanes& lanes, const word_t* pcs, const cycles_t* cycles);
+    void detach(Lanes& lanes, long_t lane, word_t pc, cycles_t cycles);
+    void invalidate();
+
+    TimingMode m_timing;
+    vector<std::unique_ptr<DCPU>> m_cpus;
+    vector<std::unique_ptr<Memory>> m_mems;
+    vector<CodeEntry> m_code;     // keyed by address, shared by the groups as they run in turn
+    vector<std::unique_ptr<CodeWatch>> m_watches;   // one per memory, stores to decoded words drop m_code
+    uint32_t m_epoch = 0;         // entries from another epoch are stale
+    BatchStats m_stats;
+};
@@ -1,4 +1,5 @@
 #include <cassert>
+#include <cstring>
 #include <dcpu-codex.h>
 
 #define NDEBUG
@@ -10,16 +11,6 @@ void pushTo8BitLittleEndian(word_t val, vector<byte_t>& bytes){
     bytes.push_back(bigEnd);
 }
 
-word_t from8BitLittleEndian(const vector<byte_t>& buffer, word_t& i) {
-    assert(i < buffer.size()-1);
-    
-    byte_t littleEnd = buffer[i];
-    byte_t bigEnd = buffer[i+1];
-    i += 2;
-    // printf("little:: %02X big: %02X, raw: %04X\n", littleEnd, bigEnd, (bigEnd << 8) | littleEnd);
-    return (bigEnd << 8) | littleEnd;
-}
-
 vector<word_t> Codex::Encode(const vector<Instruction>& instructions){
     vector<word_t> codeBuffer;
     for (const Instruction& inst : instructions){
@@ -49,13 +40,21 @@ vector<byte_t> Codex::UnpackBytes(const vector<word_t>& buffer){
 }
 
 vector<word_t> Codex::PackBytes(const vector<byte_t>& buffer){
-    vector<word_t> packedBuffer;
-    for (word_t i=0; i<buffer.size()-1;) {
-        packedBuffer.push_back(from8BitLittleEndian(buffer, i));
-    }
+    vector<word_t> packedBuffer(buffer.size() / 2);
+    PackBytes(buffer.data(), packedBuffer.size(), packedBuffer.data());
     return packedBuffer;
 }
 
+void Codex::PackBytes(const byte_t* bytes, long_t wordCount, word_t* outWords){
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    std::memcpy(outWords, bytes, wordCount * sizeof(word_t));
+#else
+    for (long_t i=0; i<wordCount; ++i) {
+        outWords[i] = static_cast<word_t>(bytes[2*i] | (bytes[2*i+1] << 8));
+    }
+#endif
+}
+
 Instruction Codex::Decode(const word_t* codebytePtr, word_t maxlen){
     assert(codebytePtr != nullptr);
     
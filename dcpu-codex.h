@@ -12,6 +12,8 @@ public:
     static string ValueToStr(Value v, bool isA, word_t nextword);
     static string OpCodeToStr(OpCode op);
     static vector<word_t> PackBytes(const vector<byte_t>& buffer);
+    // little endian byte pairs to words, a plain copy on little endian hosts
+    static void PackBytes(const byte_t* bytes, long_t wordCount, word_t* outWords);
     static vector<byte_t> UnpackBytes(const vector<word_t>& buffer);
     static vector<word_t> Encode(const vector<Instruction>& instructions);
     static vector<Instruction> Decode(const vector<word_t>& buffer);
@@ -0,0 +1,41 @@
+#include <dcpu-decode-cache.h>
+
+DecodeCache::DecodeCache()
+    : m_entries(Memory::LastValidAddress+1)
+{
+}
+
+void DecodeCache::invalidate(word_t addr) {
+    m_entries[addr].m_wordCount = 0;
+    m_entries[addr].m_skipSpan = 0;
+}
+
+void DecodeCache::clear() {
+    for (DecodedInstruction& entry : m_entries) {
+        entry.m_wordCount = 0;
+        entry.m_skipSpan = 0;
+    }
+}
+
+void DecodeCache::onMemoryWrite(word_t addr) {
+    // instructions are at most 3 words long, any entry starting up to 2 words
+    // before the written address may cover it.
+    for (word_t i=0; i<3; ++i) {
+        const word_t start = addr - i;
+        const DecodedInstruction& entry = m_entries[start];
+        if (entry.m_wordCount > i) {
+            invalidate(start);
+        }
+    }
+    // skip targets cover the instructions skipped after the conditional
+    for (word_t i=0; i<m_maxSkipSpan; ++i) {
+        DecodedInstruction& entry = m_entries[static_cast<word_t>(addr - i)];
+        if (entry.m_skipSpan > i) {
+            entry.m_skipSpan = 0;
+        }
+    }
+}
+
+void DecodeCache::onMemoryDetached() {
+    clear();
+}
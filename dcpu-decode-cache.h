@@ -0,0 +1,77 @@
+#pragma once
+#include <dcpu-codex.h>
+#include <dcpu-mem.h>
+#include <dcpu-types.h>
+#include <vector>
+
+using std::vector;
+
+struct DecodedInstruction {
+    Instruction m_instruction;
+    byte_t m_wordCount = 0;     // 0 when the entry was not decoded yet
+    cycles_t m_baseCycles = 0;
+    // conditionals, where a failed test goes and how many instructions it skips
+    word_t m_skipSpan = 0;      // 0 when not computed yet
+    word_t m_skipTarget = 0;
+    word_t m_skipCount = 0;
+};
+
+//
+// Predecoded instructions keyed by address. Entries are decoded on first
+// fetch and dropped when the memory they were decoded from is written to, so
+// self modifying code keeps working. Conditionals also get their skip target
+// on the first failed test, kept until one of the skipped words is written.
+//
+class DecodeCache : public MemoryObserver {
+public:
+    DecodeCache();
+
+    const DecodedInstruction& fetch(Memory& mem, word_t addr);
+    const DecodedInstruction& fetchSkip(Memory& mem, word_t addr);
+    void invalidate(word_t addr);
+    void clear();
+
+    void onMemoryWrite(word_t addr) override;
+    void onMemoryDetached() override;
+
+private:
+    vector<DecodedInstruction> m_entries;
+    word_t m_maxSkipSpan = 0;
+};
+
+inline const DecodedInstruction& DecodeCache::fetch(Memory& mem, word_t addr) {
+    if (!isAttachedTo(mem)) {
+        clear();
+        attach(mem);
+    }
+    DecodedInstruction& entry = m_entries[addr];
+    if (entry.m_wordCount == 0) {
+        entry.m_instruction = Codex::Decode(mem+addr, mem.LastValidAddress-addr);
+        entry.m_wordCount = entry.m_instruction.WordCount();
+        entry.m_baseCycles = entry.m_instruction.BaseCycles();
+        mem.Watch(addr, entry.m_wordCount);
+    }
+    return entry;
+}
+
+inline const DecodedInstruction& DecodeCache::fetchSkip(Memory& mem, word_t addr) {
+    const DecodedInstruction& entry = fetch(mem, addr);
+    if (entry.m_skipSpan == 0) {
+        // same walk as GetNextCodeAddressSkipIF, over cached entries
+        word_t nextPC = addr + entry.m_wordCount;
+        word_t skipCount = 0;
+        bool foundNext = false;
+        while (!foundNext) {
+            const DecodedInstruction& skipped = fetch(mem, nextPC);
+            nextPC += skipped.m_wordCount;
+            ++skipCount;
+            foundNext = !isConditionalOpCode(skipped.m_instruction.m_opcode);
+        }
+        DecodedInstruction& mutableEntry = m_entries[addr];
+        mutableEntry.m_skipTarget = nextPC;
+        mutableEntry.m_skipCount = skipCount;
+        mutableEntry.m_skipSpan = nextPC - addr;
+        m_maxSkipSpan = std::max(m_maxSkipSpan, mutableEntry.m_skipSpan);
+    }
+    return entry;
+}
@@ -0,0 +1,394 @@
+#include <dcpu-engine-block.h>
+#include <dcpu.h>
+#include <algorithm>
+
+namespace {
+    // instructions after which the pc is not known at translation time
+    bool EndsBlock(const Instruction& inst) {
+        if (inst.m_opcode == OpCode_Special)
+            return true;
+        return !isConditionalOpCode(inst.m_opcode) && inst.m_b == Value_PC;
+    }
+
+    bool IsMemoryOperand(OperandKind kind) {
+        switch (kind) {
+        case OperandKind_Ref: case OperandKind_RefNext: case OperandKind_PushPop:
+        case OperandKind_Peek: case OperandKind_Pick: case OperandKind_Next:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    bool UsesRegister(OperandKind kind, const SpecializedEngine::Operand& operand, byte_t reg) {
+        const bool isRegisterKind = kind == OperandKind_Register || kind == OperandKind_Ref
+                                    || kind == OperandKind_RefNext;
+        return isRegisterKind && operand.m_register == reg;
+    }
+}
+
+BlockEngine::BlockEngine()
+    : m_blocks(Memory::LastValidAddress+1)
+{
+}
+
+long_t BlockEngine::execute(DCPU& cpu, Memory& mem, long_t maxInstructions, cycles_t maxCycles) {
+    if (!isAttachedTo(mem)) {
+        clear();
+        attach(mem);
+    }
+    m_retired.clear();
+
+    Block* block = nullptr;
+    word_t index = 0;
+    if (m_cursorBlock != nullptr && m_cursorEpoch == m_epoch && m_cursorPC == cpu.m_pc) {
+        block = m_cursorBlock;
+        index = m_cursorIndex;
+    } else {
+        block = lookup(mem, cpu.m_pc);
+    }
+    m_cursorBlock = nullptr;
+
+    const cycles_t startCycles = cpu.m_cycles;
+    long_t executed = 0;
+    uint64_t epoch = m_epoch;
+    while (executed < maxInstructions && cpu.m_cycles - startCycles < maxCycles && cpu.m_pc < cpu.m_pcLimit) {
+        const Step& step = block->m_steps[index];
+        if (step.m_superIndex != NoIndex) {
+            // run as a unit only when no instruction but its last can reach maxCycles
+            const SuperOp& superOp = block->m_superOps[step.m_superIndex];
+            if (executed + superOp.m_count <= maxInstructions && superOp.m_maxAddr < cpu.m_pcLimit
+                && superOp.m_maxCycles <= maxCycles - (cpu.m_cycles - startCycles)) {
+                word_t nextIndex = NoIndex;
+                executed += runSuperOp(cpu, mem, superOp, nextIndex);
+                if (epoch != m_epoch) {
+                    epoch = m_epoch;
+                    block = lookup(mem, cpu.m_pc);
+                    index = 0;
+                } else if (nextIndex != NoIndex) {
+                    index = nextIndex;
+                } else {
+                    block = follow(mem, *block, cpu.m_pc);
+                    index = 0;
+                }
+                continue;
+            }
+        }
+        const SpecializedEngine::Entry& entry = step.m_entry;
+        const bool isFallback = SpecializedEngine::IsFallback(entry);
+        const cycles_t cycles = entry.m_handler(cpu, mem, entry);
+        if (cpu.m_pc == step.m_addr)
+            cpu.m_pc += entry.m_wordCount;
+        cpu.m_cycles += cycles;
+        ++executed;
+
+        if (isFallback)
+            return executed;
+
+        if (epoch != m_epoch) {
+            // the block wrote over translated code, it may be gone
+            epoch = m_epoch;
+            block = lookup(mem, cpu.m_pc);
+            index = 0;
+        } else if (cpu.m_pc == static_cast<word_t>(step.m_addr + entry.m_wordCount)
+                   && index+1 < block->m_steps.size()) {
+            ++index;
+        } else if (step.m_skipIndex != NoIndex && cpu.m_pc == entry.m_skipTarget) {
+            index = step.m_skipIndex;
+        } else {
+            block = follow(mem, *block, cpu.m_pc);
+            index = 0;
+        }
+    }
+
+    m_cursorBlock = block;
+    m_cursorIndex = index;
+    m_cursorPC = cpu.m_pc;
+    m_cursorEpoch = m_epoch;
+    return executed;
+}
+
+BlockEngine::Block* BlockEngine::lookup(Memory& mem, word_t pc) {
+    if (m_blocks[pc] == nullptr) {
+        return translate(mem, pc);
+    }
+    return m_blocks[pc].get();
+}
+
+BlockEngine::Block* BlockEngine::translate(Memory& mem, word_t start) {
+    std::unique_ptr<Block> block = std::make_unique<Block>();
+    block->m_start = start;
+
+    long_t span = 0;
+    word_t addr = start;
+    bool done = false;
+    while (!done) {
+        Step step;
+        step.m_addr = addr;
+        SpecializedEngine::Predecode(mem, addr, step.m_entry);
+        const bool isValid = step.m_entry.m_cycles != 0;
+        if (!isValid && !block->m_steps.empty()) {
+            break; // left to its own block, the reference interpreter asserts on it
+        }
+        block->m_steps.push_back(step);
+
+        const word_t offset = addr - start;
+        span = std::max<long_t>(span, offset + step.m_entry.m_span);
+        addr += step.m_entry.m_wordCount;
+        done = !isValid || EndsBlock(step.m_entry.m_instruction) || offset + step.m_entry.m_wordCount >= MaxBlockWords;
+    }
+
+    // conditionals skipping to an instruction of the block jump straight to it
+    for (word_t i=0; i<block->m_steps.size(); ++i) {
+        Step& step = block->m_steps[i];
+        if (!isConditionalOpCode(step.m_entry.m_instruction.m_opcode))
+            continue;
+        for (word_t j=i+1; j<block->m_steps.size(); ++j) {
+            if (block->m_steps[j].m_addr == step.m_entry.m_skipTarget) {
+                step.m_skipIndex = j;
+                break;
+            }
+        }
+    }
+
+    if (m_usePeephole) {
+        optimize(*block);
+    }
+
+    block->m_span = static_cast<word_t>(std::min<long_t>(span, Memory::LastValidAddress));
+    m_maxSpan = std::max(m_maxSpan, block->m_span);
+    mem.Watch(start, block->m_span);
+
+    m_blocks[start] = std::move(block);
+    return m_blocks[start].get();
+}
+
+BlockEngine::Block* BlockEngine::follow(Memory& mem, Block& from, word_t pc) {
+    for (const Exit& exit : from.m_exits) {
+        if (exit.m_epoch == m_epoch && exit.m_pc == pc) {
+            return exit.m_block;
+        }
+    }
+    Block* to = lookup(mem, pc);
+    Exit& slot = from.m_exits[0].m_epoch == m_epoch ? from.m_exits[1] : from.m_exits[0];
+    slot = Exit{pc, m_epoch, to};
+    return to;
+}
+
+void BlockEngine::optimize(Block& block) {
+    // super-ops are only entered at their first step, so they end at skip targets
+    vector<bool> isSkipTarget(block.m_steps.size(), false);
+    for (const Step& step : block.m_steps) {
+        if (step.m_skipIndex != NoIndex) {
+            isSkipTarget[step.m_skipIndex] = true;
+        }
+    }
+    word_t first = 0;
+    for (word_t i=0; i<=block.m_steps.size(); ++i) {
+        const bool isEnd = i == block.m_steps.size() || isSkipTarget[i]
+                           || SpecializedEngine::IsFallback(block.m_steps[i].m_entry);
+        if (!isEnd)
+            continue;
+        if (i - first >= 2) {
+            fuse(block, first, i);
+        }
+        first = i;
+        if (i < block.m_steps.size() && SpecializedEngine::IsFallback(block.m_steps[i].m_entry)) {
+            first = i+1;
+        }
+    }
+}
+
+void BlockEngine::fuse(Block& block, word_t first, word_t last) {
+    SuperOp superOp;
+    for (word_t i=first; i<last; ++i) {
+        const Step& step = block.m_steps[i];
+        const Instruction& inst = step.m_entry.m_instruction;
+        FusedStep fused;
+        fused.m_entry = step.m_entry;
+        fused.m_addr = step.m_addr;
+        fused.m_skipIndex = step.m_skipIndex;
+        fused.m_countBefore = superOp.m_count;
+        fused.m_cyclesBefore = superOp.m_cycles;
+        SpecializedEngine::Operand unused;
+        fused.m_a = GetOperandKind(inst.m_a, true, inst.m_wordA, unused.m_word, unused.m_register);
+        fused.m_b = GetOperandKind(inst.m_b, false, inst.m_wordB, unused.m_word, unused.m_register);
+        superOp.m_steps.push_back(fused);
+        superOp.m_count += 1;
+        superOp.m_cycles += step.m_entry.m_cycles;
+        superOp.m_maxCycles += step.m_entry.m_cycles + step.m_entry.m_skipCycles;
+        superOp.m_maxAddr = std::max(superOp.m_maxAddr, step.m_addr);
+        superOp.m_end = step.m_addr + step.m_entry.m_wordCount;
+    }
+    superOp.m_endIndex = last < block.m_steps.size() ? last : NoIndex;
+    vector<FusedStep>& steps = superOp.m_steps;
+
+    // registers holding a known value go into the operands reading them
+    bool isKnown[Registers_Count] = {};
+    word_t known[Registers_Count] = {};
+    for (FusedStep& step : steps) {
+        SpecializedEngine::Entry& entry = step.m_entry;
+        const OpCode op = entry.m_instruction.m_opcode;
+        const byte_t regA = entry.m_a.m_register;
+        const byte_t regB = entry.m_b.m_register;
+        const bool aliasesB = step.m_b == OperandKind_Register && regB == regA;  // a is read again after b changes
+        if (step.m_a == OperandKind_Register && isKnown[regA] && !aliasesB) {
+            step.m_a = OperandKind_Literal;
+            entry.m_a.m_word = known[regA];
+        } else if ((step.m_a == OperandKind_Ref || step.m_a == OperandKind_RefNext) && isKnown[regA]) {
+            entry.m_a.m_word = known[regA] + (step.m_a == OperandKind_RefNext ? entry.m_a.m_word : 0);
+            step.m_a = OperandKind_Next;
+        }
+        if ((step.m_b == OperandKind_Ref || step.m_b == OperandKind_RefNext) && isKnown[regB]) {
+            entry.m_b.m_word = known[regB] + (step.m_b == OperandKind_RefNext ? entry.m_b.m_word : 0);
+            step.m_b = OperandKind_Next;
+        }
+
+        if (!isConditionalOpCode(op) && step.m_b == OperandKind_Register) {
+            isKnown[regB] = op == OpCode_SET && step.m_a == OperandKind_Literal;
+            known[regB] = entry.m_a.m_word;
+        }
+        if (op == OpCode_STI || op == OpCode_STD) {
+            isKnown[Registers_I] = isKnown[Registers_J] = false;
+        }
+        step.m_usesPC = isConditionalOpCode(op) || step.m_a == OperandKind_PC || step.m_b == OperandKind_PC;
+        step.m_isStore = !isConditionalOpCode(op) && IsMemoryOperand(step.m_b);
+    }
+
+    // true when a later step overwrites the value before it is read or the
+    // super-op may be left
+    auto isOverwritten = [&](word_t index, auto reads, auto writes) {
+        for (word_t j=index+1; j<steps.size(); ++j) {
+            if (reads(steps[j]))
+                return false;
+            if (writes(steps[j]))
+                return true;
+            if (steps[j].m_usesPC || steps[j].m_isStore)
+                return false;
+        }
+        return false;
+    };
+    auto readsEX = [](const FusedStep& step) {
+        const OpCode op = step.m_entry.m_instruction.m_opcode;
+        return step.m_a == OperandKind_EX || (step.m_b == OperandKind_EX && op != OpCode_SET)
+            || op == OpCode_ADX || op == OpCode_SBX;
+    };
+    auto writesEX = [](const FusedStep& step) {
+        const OpCode op = step.m_entry.m_instruction.m_opcode;
+        return !isConditionalOpCode(op) && (overwritesEX(op) || step.m_b == OperandKind_EX);
+    };
+    for (word_t i=0; i<steps.size(); ++i) {
+        FusedStep& step = steps[i];
+        const OpCode op = step.m_entry.m_instruction.m_opcode;
+        const byte_t reg = step.m_entry.m_b.m_register;
+        auto readsReg = [reg](const FusedStep& other) {
+            const OpCode otherOp = other.m_entry.m_instruction.m_opcode;
+            const bool readsB = other.m_b == OperandKind_Register ? otherOp != OpCode_SET
+                                                                  : other.m_b != OperandKind_None;
+            return UsesRegister(other.m_a, other.m_entry.m_a, reg)
+                || (readsB && UsesRegister(other.m_b, other.m_entry.m_b, reg))
+                || ((otherOp == OpCode_STI || otherOp == OpCode_STD) && (reg == Registers_I || reg == Registers_J));
+        };
+        auto writesReg = [reg](const FusedStep& other) {
+            const OpCode otherOp = other.m_entry.m_instruction.m_opcode;
+            return !isConditionalOpCode(otherOp) && other.m_b == OperandKind_Register
+                && other.m_entry.m_b.m_register == reg;
+        };
+        if (op == OpCode_SET && step.m_b == OperandKind_Register && step.m_a != OperandKind_PushPop
+            && !step.m_usesPC && isOverwritten(i, readsReg, writesReg)) {
+            step.m_isDropped = true;
+        }
+        const bool keepsEX = overwritesEX(op) && step.m_b != OperandKind_EX && !step.m_isStore
+                             && !step.m_usesPC && isOverwritten(i, readsEX, writesEX);
+        step.m_entry.m_handler = SpecializedEngine::GetHandler(op, step.m_b, step.m_a, !keepsEX);
+    }
+
+    // a conditional guarding the final SET PC, literal jumps without running it
+    if (steps.size() >= 2) {
+        FusedStep& test = steps[steps.size()-2];
+        const FusedStep& jump = steps.back();
+        const bool isJump = jump.m_entry.m_instruction.m_opcode == OpCode_SET && jump.m_b == OperandKind_PC
+                            && jump.m_a == OperandKind_Literal;
+        if (isConditionalOpCode(test.m_entry.m_instruction.m_opcode) && isJump) {
+            const word_t target = jump.m_entry.m_a.m_word;
+            test.m_isBranch = true;
+            test.m_branchTarget = target == jump.m_addr ? superOp.m_end : target;
+            test.m_branchCycles = jump.m_entry.m_cycles;
+            steps.pop_back();
+        }
+    }
+
+    steps.erase(std::remove_if(steps.begin(), steps.end(), [](const FusedStep& step) { return step.m_isDropped; }),
+                steps.end());
+    block.m_steps[first].m_superIndex = static_cast<word_t>(block.m_superOps.size());
+    block.m_superOps.push_back(std::move(superOp));
+}
+
+long_t BlockEngine::runSuperOp(DCPU& cpu, Memory& mem, const SuperOp& superOp, word_t& outIndex) {
+    const uint64_t epoch = m_epoch;
+    for (const FusedStep& step : superOp.m_steps) {
+        const SpecializedEngine::Entry& entry = step.m_entry;
+        if (step.m_usesPC) {
+            cpu.m_pc = step.m_addr;
+        }
+        const cycles_t cycles = entry.m_handler(cpu, mem, entry);
+        if (step.m_isStore && epoch != m_epoch) {
+            // wrote over translated code, leave with the state exact up to here
+            cpu.m_pc = step.m_addr + entry.m_wordCount;
+            cpu.m_cycles += step.m_cyclesBefore + cycles;
+            return step.m_countBefore + 1;
+        }
+        if (!step.m_usesPC) {
+            continue;
+        }
+        if (cpu.m_pc != step.m_addr) {
+            // failed conditional or a jump
+            outIndex = step.m_skipIndex;
+            cpu.m_cycles += step.m_cyclesBefore + cycles;
+            return step.m_countBefore + 1;
+        }
+        if (step.m_isBranch) {
+            cpu.m_pc = step.m_branchTarget;
+            cpu.m_cycles += step.m_cyclesBefore + cycles + step.m_branchCycles;
+            return step.m_countBefore + 2;
+        }
+    }
+    cpu.m_pc = superOp.m_end;
+    cpu.m_cycles += superOp.m_cycles;
+    outIndex = superOp.m_endIndex;
+    return superOp.m_count;
+}
+
+void BlockEngine::invalidate(word_t start) {
+    m_retired.push_back(std::move(m_blocks[start]));
+    ++m_epoch;
+}
+
+void BlockEngine::clear() {
+    for (std::unique_ptr<Block>& block : m_blocks) {
+        if (block != nullptr) {
+            m_retired.push_back(std::move(block));
+        }
+    }
+    ++m_epoch;
+    m_cursorBlock = nullptr;
+}
+
+void BlockEngine::onMemoryWrite(word_t addr) {
+    for (word_t i=0; i<m_maxSpan; ++i) {
+        const word_t start = addr - i;
+        const Block* block = m_blocks[start].get();
+        if (block != nullptr && block->m_span > i) {
+            invalidate(start);
+        }
+    }
+}
+
+void BlockEngine::onMemoryDetached() {
+    clear();
+}
+
+void BlockEngine::setPeepholeEnabled(bool enabled) {
+    m_usePeephole = enabled;
+    clear();
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <dcpu-engine.h>
+#include <dcpu-engine-specialized.h>
+#include <dcpu-mem.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+using std::vector;
+
+//
+// Translates guest code into basic blocks once and then runs whole blocks per
+// dispatch. Conditionals get their fall through and skip targets resolved at
+// translation time (including chained IFs), so a failed test is a jump to
+// another instruction of the block instead of a decode walk. Blocks are
+// linked to the blocks they exit to. Instructions run through the
+// SpecializedEngine handlers.
+//
+// Unless disabled, runs of instructions between skip targets are also turned
+// into super-ops by a peephole pass. A super-op runs as a unit when the
+// instruction and cycle budgets allow it, guest state is only exact where it
+// can be left: after stores (they may hit translated code), failed
+// conditionals and at its end. In between, writes to EX and SETs of registers
+// that a later instruction overwrites are dropped, registers holding a literal
+// from a SET are propagated into the operands reading them and IFx followed
+// by SET PC, literal becomes a compare and branch.
+//
+class BlockEngine : public ExecutionEngine, public MemoryObserver {
+public:
+    static constexpr word_t MaxBlockWords = 64;
+
+    BlockEngine();
+    long_t execute(DCPU& cpu, Memory& mem, long_t maxInstructions, cycles_t maxCycles) override;
+
+    void onMemoryWrite(word_t addr) override;
+    void onMemoryDetached() override;
+    void setPeepholeEnabled(bool enabled) override;
+
+private:
+    static constexpr word_t NoIndex = 0xFFFF;
+
+    struct Block;
+    struct Step {
+        SpecializedEngine::Entry m_entry;
+        word_t m_addr = 0;
+        word_t m_skipIndex = NoIndex;   // conditionals, step to go to when the test fails
+        word_t m_superIndex = NoIndex;  // super-op starting at this step
+    };
+    struct FusedStep {
+        SpecializedEngine::Entry m_entry;   // handler and operands may be rewritten
+        OperandKind m_b = OperandKind_None;
+        OperandKind m_a = OperandKind_None;
+        word_t m_addr = 0;
+        word_t m_skipIndex = NoIndex;
+        word_t m_countBefore = 0;       // instructions completed before this one, dropped ones included
+        cycles_t m_cyclesBefore = 0;
+        bool m_usesPC = false;          // runs with the pc set to its address
+        bool m_isStore = false;
+        bool m_isDropped = false;
+        bool m_isBranch = false;        // conditional followed by SET PC, m_branchTarget
+        word_t m_branchTarget = 0;
+        cycles_t m_branchCycles = 0;
+    };
+    struct SuperOp {
+        vector<FusedStep> m_steps;
+        word_t m_count = 0;             // instructions, when run to its end
+        cycles_t m_cycles = 0;
+        cycles_t m_maxCycles = 0;       // bound of any run, conditionals skipping included
+        word_t m_end = 0;               // pc after its last instruction
+        word_t m_endIndex = NoIndex;
+        word_t m_maxAddr = 0;
+    };
+    struct Exit {
+        word_t m_pc = 0;
+        uint64_t m_epoch = 0;           // link is only followed while the epoch is current
+        Block* m_block = nullptr;
+    };
+    struct Block {
+        word_t m_start = 0;
+        word_t m_span = 0;              // words covered, including words skipped past the last step
+        vector<Step> m_steps;
+        vector<SuperOp> m_superOps;
+        Exit m_exits[2];
+    };
+
+    Block* lookup(Memory& mem, word_t pc);
+    Block* translate(Memory& mem, word_t start);
+    Block* follow(Memory& mem, Block& from, word_t pc);
+    void optimize(Block& block);
+    void fuse(Block& block, word_t first, word_t last);
+    long_t runSuperOp(DCPU& cpu, Memory& mem, const SuperOp& superOp, word_t& outIndex);
+    void invalidate(word_t start);
+    void clear();
+
+    vector<std::unique_ptr<Block>> m_blocks;    // keyed by start address
+    vector<std::unique_ptr<Block>> m_retired;   // invalidated, may still be executing
+    uint64_t m_epoch = 1;                       // bumped on every invalidation
+    word_t m_maxSpan = 0;
+    bool m_usePeephole = true;
+
+    // where the previous execute stopped, to resume in the middle of a block
+    Block* m_cursorBlock = nullptr;
+    word_t m_cursorIndex = 0;
+    word_t m_cursorPC = 0;
+    uint64_t m_cursorEpoch = 0;
+};
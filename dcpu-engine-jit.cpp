@@ -0,0 +1,956 @@
+#include <dcpu-engine-jit.h>
+#include <dcpu.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+
+#if DCPU_JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+namespace {
+    constexpr long_t NoNextPC = 0x10000;
+
+    struct Step {
+        SpecializedEngine::Entry m_entry;
+        word_t m_addr = 0;
+        int m_skipIndex = -1;           // conditionals, step to go to when the test fails
+    };
+
+    // instructions after which the pc is not known at translation time
+    bool IsBranch(const Instruction& inst) {
+        return !isConditionalOpCode(inst.m_opcode) && inst.m_b == Value_PC;
+    }
+
+    // most cycles one pass over the steps can charge, failed conditionals included
+    cycles_t MaxCycles(const vector<Step>& steps) {
+        cycles_t cycles = 0;
+        for (const Step& step : steps) {
+            cycles += step.m_entry.m_cycles + step.m_entry.m_skipCycles;
+        }
+        return cycles;
+    }
+}
+
+#if DCPU_JIT_SUPPORTED
+
+namespace {
+    enum HostReg {
+        RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+        R8, R9, R10, R11, R12, R13, R14, R15,
+    };
+
+    // A..J live in r8-r15, SP in rbx, EX in rbp and rsi points to the guest
+    // memory. Guest values are kept zero extended to 32 bits. rax, rcx, rdx and
+    // rdi are scratch, the context pointer and counters live on the stack.
+    constexpr int HostRegisters[Registers_Count] = { R8, R9, R10, R11, R12, R13, R14, R15 };
+    constexpr int HostSP = RBX;
+    constexpr int HostEX = RBP;
+    constexpr int HostMemory = RSI;
+    constexpr int IndexA = RDI;
+    constexpr int IndexB = RDX;
+
+    constexpr int32_t FrameContext = 0;
+    constexpr int32_t FrameCycles = 8;
+    constexpr int32_t FrameExecuted = 12;
+    constexpr int32_t FramePC = 16;         // value written by instructions with PC as b
+    constexpr int32_t FrameBudget = 20;
+    constexpr int32_t FrameSpill = 24;
+    constexpr int32_t FrameCycleBudget = 32;
+    constexpr int32_t FrameSize = 40;
+
+    enum Cond {
+        Cond_B = 0x2, Cond_AE = 0x3, Cond_E = 0x4, Cond_NE = 0x5,
+        Cond_BE = 0x6, Cond_A = 0x7, Cond_L = 0xC, Cond_GE = 0xD,
+        Cond_LE = 0xE, Cond_G = 0xF,
+    };
+
+    // ModRM.reg extensions of the 0x81/0x83 group and of the shift group
+    enum AluOp { Alu_Add = 0, Alu_Or = 1, Alu_Sbb = 3, Alu_And = 4, Alu_Sub = 5, Alu_Xor = 6, Alu_Cmp = 7 };
+    enum ShiftOp { Shift_Shl = 4, Shift_Shr = 5, Shift_Sar = 7 };
+
+    enum Size { Size_16, Size_32, Size_64 };
+
+    struct Mem {
+        int m_base;
+        int m_index;        // -1 when there is none
+        int m_scale;
+        int32_t m_disp;
+    };
+
+    Mem Frame(int32_t offset) { return Mem{RSP, -1, 1, offset}; }
+
+    //
+    // Minimal x86-64 encoder for the instructions the translator needs. Jumps
+    // are always rel32 and resolved when their label is bound.
+    //
+    class Assembler {
+    public:
+        vector<byte_t> m_bytes;
+
+        int newLabel() {
+            m_labels.push_back(Label{});
+            return static_cast<int>(m_labels.size()) - 1;
+        }
+        void bind(int label) {
+            Label& l = m_labels[label];
+            l.m_pos = static_cast<int32_t>(m_bytes.size());
+            for (int32_t fixup : l.m_fixups) {
+                patch(fixup, l.m_pos - (fixup + 4));
+            }
+            l.m_fixups.clear();
+        }
+        void jmp(int label) { byte(0xE9); rel(label); }
+        void jcc(Cond cc, int label) { byte(0x0F); byte(0x80 | cc); rel(label); }
+
+        void mov(int dst, int src, Size size=Size_32) { rr({0x89}, src, dst, size); }
+        void movImm(int dst, uint32_t imm) { rex(Size_32, 0, -1, dst); byte(0xB8 | (dst & 7)); dword(imm); }
+        void movImm64(int dst, uint64_t imm) { rex(Size_64, 0, -1, dst); byte(0xB8 | (dst & 7)); qword(imm); }
+        void load(int dst, const Mem& m, Size size=Size_32) { rm({0x8B}, dst, m, size); }
+        void store(const Mem& m, int src, Size size=Size_32) { rm({0x89}, src, m, size); }
+        void storeImm(const Mem& m, uint32_t imm) { rm({0xC7}, 0, m); dword(imm); }
+        void storeByteImm(const Mem& m, byte_t imm) { rm({0xC6}, 0, m); byte(imm); }
+        void movzxWord(int dst, int src) { rr({0x0F, 0xB7}, dst, src); }
+        void movzxWord(int dst, const Mem& m) { rm({0x0F, 0xB7}, dst, m); }
+        void movzxByte(int dst, int src) { rr({0x0F, 0xB6}, dst, src); }
+        void movsxWord(int dst, int src, Size size=Size_32) { rr({0x0F, 0xBF}, dst, src, size); }
+        void cmov(Cond cc, int dst, int src) { rr({0x0F, static_cast<byte_t>(0x40 | cc)}, dst, src); }
+        void setcc(Cond cc, int dst) { rr({0x0F, static_cast<byte_t>(0x90 | cc)}, 0, dst); }
+
+        void alu(AluOp op, int dst, int src) { rr({static_cast<byte_t>(op << 3 | 0x01)}, src, dst); }
+        void aluImm(AluOp op, int dst, uint32_t imm, Size size=Size_32) {
+            if (imm <= 0x7F) {
+                rr({0x83}, op, dst, size); byte(imm);
+            } else {
+                rr({0x81}, op, dst, size); size == Size_16 ? word(imm) : dword(imm);
+            }
+        }
+        void aluImm(AluOp op, const Mem& m, uint32_t imm) { rm({0x81}, op, m); dword(imm); }
+        void cmp(int reg, const Mem& m) { rm({0x3B}, reg, m); }
+        void test(int dst, int src) { rr({0x85}, src, dst); }
+        void imul(int dst, int src) { rr({0x0F, 0xAF}, dst, src); }
+        void div(int src) { rr({0xF7}, 6, src); }
+        void idiv(int src) { rr({0xF7}, 7, src); }
+        void neg(int dst) { rr({0xF7}, 3, dst); }
+        void cdq() { byte(0x99); }
+        void shiftCl(ShiftOp op, int dst, Size size=Size_32) { rr({0xD3}, op, dst, size); }
+        void shiftImm(ShiftOp op, int dst, byte_t imm) { rr({0xC1}, op, dst); byte(imm); }
+        void bt(int base, int bit) { rr({0x0F, 0xA3}, bit, base, Size_64); }
+        void push(int reg) { rex(Size_32, 0, -1, reg); byte(0x50 | (reg & 7)); }
+        void pop(int reg) { rex(Size_32, 0, -1, reg); byte(0x58 | (reg & 7)); }
+        void ret() { byte(0xC3); }
+
+    private:
+        struct Label {
+            int32_t m_pos = -1;
+            vector<int32_t> m_fixups;
+        };
+
+        void byte(uint32_t b) { m_bytes.push_back(static_cast<byte_t>(b)); }
+        void word(uint32_t w) { byte(w); byte(w >> 8); }
+        void dword(uint32_t d) { word(d); word(d >> 16); }
+        void qword(uint64_t q) { dword(static_cast<uint32_t>(q)); dword(static_cast<uint32_t>(q >> 32)); }
+        void patch(int32_t pos, int32_t value) { std::memcpy(&m_bytes[pos], &value, sizeof(value)); }
+        void rel(int label) {
+            const Label& l = m_labels[label];
+            const int32_t pos = static_cast<int32_t>(m_bytes.size());
+            dword(0);
+            if (l.m_pos >= 0) {
+                patch(pos, l.m_pos - (pos + 4));
+            } else {
+                m_labels[label].m_fixups.push_back(pos);
+            }
+        }
+
+        void rex(Size size, int reg, int index, int base) {
+            byte_t rex = 0x40;
+            if (size == Size_64) rex |= 0x08;
+            if (reg & 8) rex |= 0x04;
+            if (index >= 0 && (index & 8)) rex |= 0x02;
+            if (base & 8) rex |= 0x01;
+            if (rex != 0x40) byte(rex);
+        }
+        void rr(std::initializer_list<byte_t> opcode, int reg, int rm, Size size=Size_32) {
+            if (size == Size_16) byte(0x66);
+            rex(size, reg, -1, rm);
+            for (byte_t b : opcode) byte(b);
+            byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+        }
+        void rm(std::initializer_list<byte_t> opcode, int reg, const Mem& m, Size size=Size_32) {
+            if (size == Size_16) byte(0x66);
+            rex(size, reg, m.m_index, m.m_base);
+            for (byte_t b : opcode) byte(b);
+            const bool needsSib = m.m_index >= 0 || (m.m_base & 7) == RSP;
+            int mod = 2;
+            if (m.m_disp == 0 && (m.m_base & 7) != RBP) {
+                mod = 0;
+            } else if (m.m_disp >= -128 && m.m_disp <= 127) {
+                mod = 1;
+            }
+            byte(mod << 6 | (reg & 7) << 3 | (needsSib ? 4 : (m.m_base & 7)));
+            if (needsSib) {
+                const int scale = m.m_scale == 8 ? 3 : m.m_scale == 4 ? 2 : m.m_scale == 2 ? 1 : 0;
+                const int index = m.m_index >= 0 ? (m.m_index & 7) : 4;
+                byte(scale << 6 | index << 3 | (m.m_base & 7));
+            }
+            if (mod == 1) {
+                byte(m.m_disp);
+            } else if (mod == 2) {
+                dword(m.m_disp);
+            }
+        }
+
+        vector<Label> m_labels;
+    };
+
+    // where an operand lives once its address has been computed
+    struct Location {
+        enum Type { Type_Register, Type_Memory, Type_Immediate, Type_PC };
+        Type m_type = Type_Immediate;
+        OperandKind m_kind = OperandKind_None;
+        int m_reg = -1;         // host register, or index register of a memory operand (-1 when absolute)
+        word_t m_word = 0;      // immediate value or absolute address
+    };
+
+    //
+    // Emits the code of one block. Cycles and instruction counts are added up
+    // at translation time and only written to the frame before labels and
+    // exits. Conditionals branch to out of line stubs accounting for the
+    // skipped instructions.
+    //
+    class Translator {
+    public:
+        Translator(const vector<Step>& steps, word_t start, long_t end, const uint64_t* watched, byte_t* dirtyPages)
+            : m_steps(steps), m_start(start), m_end(end), m_watched(watched), m_dirtyPages(dirtyPages)
+        {
+            m_top = m_asm.newLabel();
+            m_exit = m_asm.newLabel();
+            m_touchExit = m_asm.newLabel();
+            m_stepLabels.resize(m_steps.size(), -1);
+            for (const Step& step : m_steps) {
+                if (step.m_skipIndex >= 0 && m_stepLabels[step.m_skipIndex] < 0) {
+                    m_stepLabels[step.m_skipIndex] = m_asm.newLabel();
+                }
+            }
+        }
+
+        vector<byte_t> translate();
+
+    private:
+        struct Stub {
+            int m_label;
+            cycles_t m_cycles;
+            long_t m_executed;
+            int m_target;       // label to jump to, -1 to leave with m_pc
+            word_t m_pc;
+            bool m_touch;
+        };
+
+        void prologue();
+        void epilogue();
+        void step(size_t index);
+        void operation(OpCode op, const Location& a, const Location& b);
+        void conditional(const Step& step, const Location& a, const Location& b);
+        void branch(const Step& step);
+        void clampShiftCount();
+        void touchCheck(const Location& b, word_t nextPC);
+
+        Location resolve(OperandKind kind, const SpecializedEngine::Operand& operand, bool isA, word_t addr);
+        void load(const Location& loc, int dst);
+        void reload(const Location& a, const Location& b, int dst);
+        void store(const Location& loc);
+        bool mayAlias(const Location& a, const Location& b) const;
+        Mem memoryOf(const Location& loc) const;
+        void flush();
+        int stub(word_t pc, int target, cycles_t extraCycles, bool touch);
+
+        Assembler m_asm;
+        const vector<Step>& m_steps;
+        word_t m_start;
+        long_t m_end;
+        const uint64_t* m_watched;
+        byte_t* m_dirtyPages;       // nullptr unless memory tracks dirty pages
+        vector<int> m_stepLabels;
+        vector<Stub> m_stubs;
+        cycles_t m_pendingCycles = 0;
+        long_t m_pendingExecuted = 0;
+        int m_top;
+        int m_exit;
+        int m_touchExit;
+    };
+
+    vector<byte_t> Translator::translate() {
+        prologue();
+        for (size_t i=0; i<m_steps.size(); ++i) {
+            step(i);
+        }
+        flush();
+        m_asm.movImm(RAX, static_cast<uint32_t>(m_end & 0xFFFF));
+        m_asm.jmp(m_exit);
+
+        for (const Stub& stub : m_stubs) {
+            m_asm.bind(stub.m_label);
+            if (stub.m_cycles != 0)
+                m_asm.aluImm(Alu_Add, Frame(FrameCycles), stub.m_cycles);
+            if (stub.m_executed != 0)
+                m_asm.aluImm(Alu_Add, Frame(FrameExecuted), stub.m_executed);
+            if (stub.m_target >= 0) {
+                m_asm.jmp(stub.m_target);
+            } else {
+                m_asm.movImm(RAX, stub.m_pc);
+                m_asm.jmp(stub.m_touch ? m_touchExit : m_exit);
+            }
+        }
+        epilogue();
+        return m_asm.m_bytes;
+    }
+
+    void Translator::prologue() {
+        using Context = JitEngine::Context;
+        for (int reg : {RBX, RBP, R12, R13, R14, R15}) {
+            m_asm.push(reg);
+        }
+        m_asm.aluImm(Alu_Sub, RSP, FrameSize, Size_64);
+        m_asm.store(Frame(FrameContext), RDI, Size_64);
+        m_asm.storeImm(Frame(FrameCycles), 0);
+        m_asm.storeImm(Frame(FrameExecuted), 0);
+        m_asm.load(RAX, Mem{RDI, -1, 1, offsetof(Context, m_budget)});
+        m_asm.store(Frame(FrameBudget), RAX);
+        m_asm.load(RAX, Mem{RDI, -1, 1, offsetof(Context, m_cycleBudget)});
+        m_asm.store(Frame(FrameCycleBudget), RAX);
+        m_asm.load(HostMemory, Mem{RDI, -1, 1, offsetof(Context, m_memory)}, Size_64);
+        for (int i=0; i<Registers_Count; ++i) {
+            m_asm.movzxWord(HostRegisters[i], Mem{RDI, -1, 1, static_cast<int32_t>(offsetof(Context, m_registers) + i*2)});
+        }
+        m_asm.movzxWord(HostSP, Mem{RDI, -1, 1, offsetof(Context, m_sp)});
+        m_asm.movzxWord(HostEX, Mem{RDI, -1, 1, offsetof(Context, m_ex)});
+        m_asm.bind(m_top);
+    }
+
+    void Translator::epilogue() {
+        using Context = JitEngine::Context;
+        // rax is the next pc, rdx the written address for touch exits
+        m_asm.bind(m_touchExit);
+        m_asm.load(RDI, Frame(FrameContext), Size_64);
+        m_asm.store(Mem{RDI, -1, 1, offsetof(Context, m_touchAddr)}, RDX, Size_16);
+        m_asm.storeImm(Mem{RDI, -1, 1, offsetof(Context, m_touched)}, 1);
+
+        m_asm.bind(m_exit);
+        m_asm.load(RDI, Frame(FrameContext), Size_64);
+        m_asm.store(Mem{RDI, -1, 1, offsetof(Context, m_pc)}, RAX, Size_16);
+        for (int i=0; i<Registers_Count; ++i) {
+            m_asm.store(Mem{RDI, -1, 1, static_cast<int32_t>(offsetof(Context, m_registers) + i*2)}, HostRegisters[i], Size_16);
+        }
+        m_asm.store(Mem{RDI, -1, 1, offsetof(Context, m_sp)}, HostSP, Size_16);
+        m_asm.store(Mem{RDI, -1, 1, offsetof(Context, m_ex)}, HostEX, Size_16);
+        m_asm.load(RCX, Frame(FrameCycles));
+        m_asm.store(Mem{RDI, -1, 1, offsetof(Context, m_cycles)}, RCX);
+        m_asm.load(RCX, Frame(FrameExecuted));
+        m_asm.store(Mem{RDI, -1, 1, offsetof(Context, m_executed)}, RCX);
+        m_asm.aluImm(Alu_Add, RSP, FrameSize, Size_64);
+        for (int reg : {R15, R14, R13, R12, RBP, RBX}) {
+            m_asm.pop(reg);
+        }
+        m_asm.ret();
+    }
+
+    void Translator::step(size_t index) {
+        const Step& step = m_steps[index];
+        const SpecializedEngine::Entry& entry = step.m_entry;
+        const Instruction& inst = entry.m_instruction;
+
+        if (m_stepLabels[index] >= 0) {
+            flush();
+            m_asm.bind(m_stepLabels[index]);
+        }
+        m_pendingCycles += entry.m_cycles;
+        m_pendingExecuted += 1;
+
+        // a first, its side effects on SP are seen by b. Values are read once
+        // both addresses are known, as DCPU::eval does.
+        word_t word = 0;
+        byte_t reg = 0;
+        const OperandKind aKind = GetOperandKind(inst.m_a, true, inst.m_wordA, word, reg);
+        const OperandKind bKind = GetOperandKind(inst.m_b, false, inst.m_wordB, word, reg);
+        const Location a = resolve(aKind, entry.m_a, true, step.m_addr);
+        const Location b = resolve(bKind, entry.m_b, false, step.m_addr);
+
+        if (isConditionalOpCode(inst.m_opcode)) {
+            conditional(step, a, b);
+            return;
+        }
+        operation(inst.m_opcode, a, b);
+        if (b.m_type == Location::Type_Memory) {
+            touchCheck(b, step.m_addr + entry.m_wordCount);
+        } else if (b.m_type == Location::Type_PC) {
+            branch(step);
+        }
+    }
+
+    void Translator::operation(OpCode op, const Location& a, const Location& b) {
+        if (op == OpCode_SET) {
+            load(a, RAX);
+            store(b);
+            return;
+        }
+        load(b, RAX);
+        load(a, RCX);
+        const bool alias = mayAlias(a, b);
+        const bool spillB = b.m_type == Location::Type_Memory && b.m_reg >= 0;
+        switch (op) {
+        case OpCode_ADD:
+            // EX is computed from the operands read back after the write
+            m_asm.alu(Alu_Add, RAX, RCX);
+            store(b);
+            if (alias)
+                reload(a, b, RCX);
+            m_asm.movzxWord(RAX, RAX);
+            m_asm.alu(Alu_Cmp, RAX, RCX);
+            m_asm.setcc(Cond_B, RCX);
+            m_asm.movzxByte(HostEX, RCX);
+            break;
+        case OpCode_SUB:
+            m_asm.alu(Alu_Sub, RAX, RCX);
+            m_asm.alu(Alu_Sbb, RCX, RCX);     // ecx = borrow ? -1 : 0
+            store(b);
+            m_asm.movzxWord(HostEX, RCX);
+            break;
+        case OpCode_MUL:
+        case OpCode_MLI:
+            m_asm.imul(RAX, RCX);
+            m_asm.mov(RCX, RAX);
+            m_asm.shiftImm(Shift_Shr, RCX, 16);
+            store(b);
+            m_asm.mov(HostEX, RCX);
+            break;
+        case OpCode_DIV:
+        case OpCode_DVI:
+        case OpCode_MOD:
+        case OpCode_MDI: {
+            const int zero = m_asm.newLabel();
+            const int done = m_asm.newLabel();
+            m_asm.test(RCX, RCX);
+            m_asm.jcc(Cond_E, zero);
+            if (spillB)
+                m_asm.store(Frame(FrameSpill), IndexB);
+            if (op == OpCode_DIV) {
+                // one division gives both, b/a is ((b<<16)/a)>>16
+                m_asm.shiftImm(Shift_Shl, RAX, 16);
+                m_asm.alu(Alu_Xor, RDX, RDX);
+                m_asm.div(RCX);
+                m_asm.mov(RCX, RAX);
+                m_asm.shiftImm(Shift_Shr, RAX, 16);
+                if (spillB)
+                    m_asm.load(IndexB, Frame(FrameSpill));
+                store(b);
+                m_asm.movzxWord(HostEX, RCX);
+            } else if (op == OpCode_DVI) {
+                // EX comes from the written b and a read back, divided as ints
+                m_asm.alu(Alu_Xor, RDX, RDX);
+                m_asm.div(RCX);
+                if (spillB)
+                    m_asm.load(IndexB, Frame(FrameSpill));
+                store(b);
+                if (alias)
+                    reload(a, b, RCX);
+                m_asm.movzxWord(RAX, RAX);
+                m_asm.shiftImm(Shift_Shl, RAX, 16);
+                m_asm.cdq();
+                m_asm.idiv(RCX);
+                m_asm.movzxWord(HostEX, RAX);
+                if (spillB)
+                    m_asm.load(IndexB, Frame(FrameSpill));
+            } else {
+                if (op == OpCode_MOD) {
+                    m_asm.alu(Alu_Xor, RDX, RDX);
+                    m_asm.div(RCX);
+                } else {
+                    m_asm.movsxWord(RAX, RAX);
+                    m_asm.movsxWord(RCX, RCX);
+                    m_asm.cdq();
+                    m_asm.idiv(RCX);
+                }
+                m_asm.mov(RAX, RDX);
+                if (spillB)
+                    m_asm.load(IndexB, Frame(FrameSpill));
+                store(b);
+            }
+            m_asm.jmp(done);
+            m_asm.bind(zero);
+            m_asm.alu(Alu_Xor, HostEX, HostEX);
+            m_asm.alu(Alu_Xor, RAX, RAX);
+            store(b);
+            m_asm.bind(done);
+            break;
+        }
+        case OpCode_AND:
+            m_asm.alu(Alu_And, RAX, RCX);
+            store(b);
+            break;
+        case OpCode_BOR:
+            m_asm.alu(Alu_Or, RAX, RCX);
+            store(b);
+            break;
+        case OpCode_XOR:
+            m_asm.alu(Alu_Xor, RAX, RCX);
+            store(b);
+            break;
+        case OpCode_SHR:
+        case OpCode_ASR:
+        case OpCode_SHL:
+            // EX is ((b<<16)>>a) for SHR and ASR, ((b<<a)>>16) for SHL, with a
+            // read back after the write. Same as ShiftCount, counts are clamped
+            // to 32 and shifts done on 64 bits.
+            m_asm.store(Frame(FrameSpill+4), RAX);
+            clampShiftCount();
+            if (op == OpCode_ASR) {
+                m_asm.movsxWord(RAX, RAX, Size_64);
+            }
+            m_asm.shiftCl(op == OpCode_SHR ? Shift_Shr : op == OpCode_ASR ? Shift_Sar : Shift_Shl, RAX, Size_64);
+            store(b);
+            if (alias) {
+                reload(a, b, RCX);
+                clampShiftCount();
+            }
+            m_asm.load(RAX, Frame(FrameSpill+4));
+            if (op == OpCode_SHL) {
+                m_asm.shiftCl(Shift_Shl, RAX, Size_64);
+                m_asm.shiftImm(Shift_Shr, RAX, 16);
+            } else {
+                m_asm.shiftImm(Shift_Shl, RAX, 16);
+                m_asm.shiftCl(Shift_Shr, RAX, Size_64);
+            }
+            m_asm.movzxWord(HostEX, RAX);
+            break;
+        case OpCode_ADX:
+            m_asm.alu(Alu_Add, RAX, RCX);
+            m_asm.alu(Alu_Add, RAX, HostEX);
+            m_asm.mov(RCX, RAX);
+            m_asm.shiftImm(Shift_Shr, RCX, 16);
+            store(b);
+            m_asm.mov(HostEX, RCX);
+            break;
+        case OpCode_SBX:
+            m_asm.mov(IndexA, RAX);
+            m_asm.alu(Alu_Sub, RAX, RCX);
+            m_asm.alu(Alu_Add, RAX, HostEX);
+            m_asm.movzxWord(RAX, RAX);
+            store(b);
+            m_asm.alu(Alu_Cmp, RAX, IndexA);
+            m_asm.setcc(Cond_A, RCX);
+            m_asm.movzxByte(RCX, RCX);
+            m_asm.neg(RCX);
+            m_asm.movzxWord(HostEX, RCX);
+            break;
+        case OpCode_STI:
+        case OpCode_STD: {
+            const AluOp step = op == OpCode_STI ? Alu_Add : Alu_Sub;
+            m_asm.mov(RAX, RCX);
+            store(b);
+            m_asm.aluImm(step, HostRegisters[Registers_I], 1, Size_16);
+            m_asm.aluImm(step, HostRegisters[Registers_J], 1, Size_16);
+            break;
+        }
+        default:
+            dcpu_assert_fmt(false, "opcode 0x%02X can not be translated", op);
+            break;
+        }
+    }
+
+    void Translator::conditional(const Step& step, const Location& a, const Location& b) {
+        const OpCode op = step.m_entry.m_instruction.m_opcode;
+        load(b, RAX);
+        load(a, RCX);
+        if (op == OpCode_IFA || op == OpCode_IFU) {
+            m_asm.movsxWord(RAX, RAX);
+            m_asm.movsxWord(RCX, RCX);
+        }
+        if (op == OpCode_IFB || op == OpCode_IFC) {
+            m_asm.test(RAX, RCX);
+        } else {
+            m_asm.alu(Alu_Cmp, RAX, RCX);
+        }
+        Cond skip = Cond_E;
+        switch (op) {
+        case OpCode_IFB: skip = Cond_E; break;
+        case OpCode_IFC: skip = Cond_NE; break;
+        case OpCode_IFE: skip = Cond_NE; break;
+        case OpCode_IFN: skip = Cond_E; break;
+        case OpCode_IFG: skip = Cond_BE; break;
+        case OpCode_IFA: skip = Cond_LE; break;
+        case OpCode_IFL: skip = Cond_AE; break;
+        case OpCode_IFU: skip = Cond_GE; break;
+        default: break;
+        }
+        const int target = step.m_skipIndex >= 0 ? m_stepLabels[step.m_skipIndex] : -1;
+        m_asm.jcc(skip, stub(step.m_entry.m_skipTarget, target, step.m_entry.m_skipCycles, false));
+    }
+
+    void Translator::branch(const Step& step) {
+        // DCPU::step only moves past an instruction leaving the pc unchanged
+        const word_t addr = step.m_addr;
+        m_asm.load(RAX, Frame(FramePC));
+        m_asm.movImm(RCX, static_cast<word_t>(addr + step.m_entry.m_wordCount));
+        m_asm.aluImm(Alu_Cmp, RAX, addr);
+        m_asm.cmov(Cond_E, RAX, RCX);
+        flush();
+
+        // loops on the block itself stay in native code while both budgets
+        // allow another whole pass
+        m_asm.aluImm(Alu_Cmp, RAX, m_start);
+        m_asm.jcc(Cond_NE, m_exit);
+        m_asm.load(RCX, Frame(FrameExecuted));
+        m_asm.aluImm(Alu_Add, RCX, static_cast<uint32_t>(m_steps.size()));
+        m_asm.cmp(RCX, Frame(FrameBudget));
+        m_asm.jcc(Cond_A, m_exit);
+        m_asm.load(RCX, Frame(FrameCycles));
+        m_asm.aluImm(Alu_Add, RCX, MaxCycles(m_steps));
+        m_asm.cmp(RCX, Frame(FrameCycleBudget));
+        m_asm.jcc(Cond_BE, m_top);
+        m_asm.jmp(m_exit);
+    }
+
+    void Translator::clampShiftCount() {
+        const int inRange = m_asm.newLabel();
+        m_asm.aluImm(Alu_Cmp, RCX, 32);
+        m_asm.jcc(Cond_BE, inRange);
+        m_asm.movImm(RCX, 32);
+        m_asm.bind(inRange);
+    }
+
+    void Translator::touchCheck(const Location& b, word_t nextPC) {
+        if (b.m_reg < 0) {
+            m_asm.movImm(IndexB, b.m_word);
+        }
+        m_asm.mov(RAX, IndexB);
+        m_asm.shiftImm(Shift_Shr, RAX, 6);
+        if (m_dirtyPages != nullptr) {
+            static_assert(Memory::DirtyPageWords == 64, "dirty pages and watch blocks share the index");
+            m_asm.movImm64(RCX, reinterpret_cast<uint64_t>(m_dirtyPages));
+            m_asm.storeByteImm(Mem{RCX, RAX, 1, 0}, 1);
+        }
+        m_asm.movImm64(RCX, reinterpret_cast<uint64_t>(m_watched));
+        m_asm.load(RAX, Mem{RCX, RAX, 8, 0}, Size_64);
+        m_asm.bt(RAX, IndexB);
+        m_asm.jcc(Cond_B, stub(nextPC, -1, 0, true));
+    }
+
+    Location Translator::resolve(OperandKind kind, const SpecializedEngine::Operand& operand, bool isA, word_t addr) {
+        const int index = isA ? IndexA : IndexB;
+        Location loc;
+        loc.m_kind = kind;
+        switch (kind) {
+        case OperandKind_Register:
+            loc.m_type = Location::Type_Register;
+            loc.m_reg = HostRegisters[operand.m_register];
+            break;
+        case OperandKind_Ref:
+            m_asm.mov(index, HostRegisters[operand.m_register]);
+            loc.m_type = Location::Type_Memory;
+            loc.m_reg = index;
+            break;
+        case OperandKind_RefNext:
+        case OperandKind_Pick:
+            m_asm.mov(index, kind == OperandKind_Pick ? HostSP : HostRegisters[operand.m_register]);
+            m_asm.aluImm(Alu_Add, index, operand.m_word);
+            m_asm.movzxWord(index, index);
+            loc.m_type = Location::Type_Memory;
+            loc.m_reg = index;
+            break;
+        case OperandKind_PushPop:
+            if (isA) {
+                m_asm.mov(index, HostSP);
+                m_asm.aluImm(Alu_Add, HostSP, 1, Size_16);
+            } else {
+                m_asm.aluImm(Alu_Sub, HostSP, 1, Size_16);
+                m_asm.mov(index, HostSP);
+            }
+            loc.m_type = Location::Type_Memory;
+            loc.m_reg = index;
+            break;
+        case OperandKind_Peek:
+            m_asm.mov(index, HostSP);
+            loc.m_type = Location::Type_Memory;
+            loc.m_reg = index;
+            break;
+        case OperandKind_SP:
+            loc.m_type = Location::Type_Register;
+            loc.m_reg = HostSP;
+            break;
+        case OperandKind_EX:
+            loc.m_type = Location::Type_Register;
+            loc.m_reg = HostEX;
+            break;
+        case OperandKind_PC:
+            // reads see the address of the instruction
+            loc.m_type = isA ? Location::Type_Immediate : Location::Type_PC;
+            loc.m_word = addr;
+            break;
+        case OperandKind_Next:
+            loc.m_type = Location::Type_Memory;
+            loc.m_word = operand.m_word;
+            break;
+        default:
+            loc.m_type = Location::Type_Immediate;
+            loc.m_word = operand.m_word;
+            break;
+        }
+        return loc;
+    }
+
+    void Translator::load(const Location& loc, int dst) {
+        switch (loc.m_type) {
+        case Location::Type_Register: m_asm.mov(dst, loc.m_reg); break;
+        case Location::Type_Memory: m_asm.movzxWord(dst, memoryOf(loc)); break;
+        default: m_asm.movImm(dst, loc.m_word); break;
+        }
+    }
+
+    // value of a after b was written, they may be the same location
+    void Translator::reload(const Location& a, const Location& b, int dst) {
+        if (a.m_kind == OperandKind_PC && b.m_kind == OperandKind_PC) {
+            m_asm.load(dst, Frame(FramePC));
+        } else {
+            load(a, dst);
+        }
+    }
+
+    // writes the low word of rax to the location
+    void Translator::store(const Location& loc) {
+        switch (loc.m_type) {
+        case Location::Type_Register:
+            m_asm.movzxWord(loc.m_reg, RAX);
+            break;
+        case Location::Type_Memory:
+            m_asm.store(memoryOf(loc), RAX, Size_16);
+            break;
+        case Location::Type_PC:
+            m_asm.movzxWord(RAX, RAX);
+            m_asm.store(Frame(FramePC), RAX);
+            break;
+        default:
+            break;  // literals are written to a scratch word
+        }
+    }
+
+    bool Translator::mayAlias(const Location& a, const Location& b) const {
+        if (a.m_kind == OperandKind_PC && b.m_kind == OperandKind_PC)
+            return true;
+        if (a.m_type != b.m_type)
+            return false;
+        if (a.m_type == Location::Type_Register)
+            return a.m_reg == b.m_reg;
+        if (a.m_type == Location::Type_Memory)
+            return a.m_reg >= 0 || b.m_reg >= 0 || a.m_word == b.m_word;
+        return false;
+    }
+
+    Mem Translator::memoryOf(const Location& loc) const {
+        if (loc.m_reg >= 0)
+            return Mem{HostMemory, loc.m_reg, 2, 0};
+        return Mem{HostMemory, -1, 1, static_cast<int32_t>(loc.m_word) * 2};
+    }
+
+    void Translator::flush() {
+        if (m_pendingCycles != 0)
+            m_asm.aluImm(Alu_Add, Frame(FrameCycles), m_pendingCycles);
+        if (m_pendingExecuted != 0)
+            m_asm.aluImm(Alu_Add, Frame(FrameExecuted), m_pendingExecuted);
+        m_pendingCycles = 0;
+        m_pendingExecuted = 0;
+    }
+
+    int Translator::stub(word_t pc, int target, cycles_t extraCycles, bool touch) {
+        const int label = m_asm.newLabel();
+        m_stubs.push_back(Stub{label, m_pendingCycles + extraCycles, m_pendingExecuted, target, pc, touch});
+        return label;
+    }
+}
+
+#endif
+
+JitEngine::JitEngine()
+    : m_blocks(Memory::LastValidAddress+1)
+    , m_counters(Memory::LastValidAddress+1, 0)
+    , m_nextPC(NoNextPC)
+{
+#if DCPU_JIT_SUPPORTED
+    void* code = mmap(nullptr, CodeBufferBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    m_code = code != MAP_FAILED ? static_cast<byte_t*>(code) : nullptr;
+#endif
+}
+
+JitEngine::~JitEngine() {
+#if DCPU_JIT_SUPPORTED
+    if (m_code != nullptr) {
+        munmap(m_code, CodeBufferBytes);
+    }
+#endif
+}
+
+long_t JitEngine::execute(DCPU& cpu, Memory& mem, long_t maxInstructions, cycles_t maxCycles) {
+    if (!isAttachedTo(mem)) {
+        clear();
+        clearBlocks();
+        attach(mem);
+    }
+    const cycles_t startCycles = cpu.m_cycles;
+    long_t executed = 0;
+    while (executed < maxInstructions && cpu.m_cycles - startCycles < maxCycles && cpu.m_pc < cpu.m_pcLimit) {
+        const word_t pc = cpu.m_pc;
+        if (pc != m_nextPC && m_blocks[pc] == nullptr && ++m_counters[pc] == HotThreshold) {
+            compile(mem, pc);
+        }
+        // a pass only ends on its last instruction past maxCycles, as when stepping
+        const Block* block = m_blocks[pc].get();
+        const cycles_t cycleBudget = maxCycles - (cpu.m_cycles - startCycles);
+        if (block != nullptr && block->m_stepCount <= maxInstructions - executed && block->m_maxCycles <= cycleBudget
+            && block->m_end <= cpu.m_pcLimit) {
+            executed += run(cpu, mem, *block, maxInstructions - executed, cycleBudget);
+            m_nextPC = NoNextPC;
+            continue;
+        }
+
+        const Entry& entry = m_entries[pc];
+        if (entry.m_handler == nullptr)
+            predecode(mem, pc);
+        const bool isFallback = IsFallback(entry);
+        const cycles_t cycles = entry.m_handler(cpu, mem, entry);
+        if (cpu.m_pc == pc)
+            cpu.m_pc += entry.m_wordCount;
+        cpu.m_cycles += cycles;
+        m_nextPC = static_cast<word_t>(pc + entry.m_wordCount);
+        ++executed;
+        if (isFallback)
+            break;
+    }
+    return executed;
+}
+
+long_t JitEngine::run(DCPU& cpu, Memory& mem, const Block& block, long_t budget, cycles_t cycleBudget) {
+    Context& context = m_context;
+    std::copy(cpu.m_registers, cpu.m_registers + Registers_Count, context.m_registers);
+    context.m_sp = cpu.m_sp;
+    context.m_ex = cpu.m_ex;
+    context.m_touched = 0;
+    context.m_budget = budget;
+    context.m_cycleBudget = cycleBudget;
+    context.m_memory = mem + 0;
+
+    block.m_code(&context);
+
+    std::copy(context.m_registers, context.m_registers + Registers_Count, cpu.m_registers);
+    cpu.m_sp = context.m_sp;
+    cpu.m_ex = context.m_ex;
+    cpu.m_pc = context.m_pc;
+    cpu.m_cycles += context.m_cycles;
+    if (context.m_touched) {
+        // the block stopped right after this store, translations may be stale
+        mem.Touch(context.m_touchAddr);
+    }
+    return context.m_executed;
+}
+
+void JitEngine::compile(Memory& mem, word_t start) {
+#if DCPU_JIT_SUPPORTED
+    if (m_code == nullptr)
+        return;
+
+    // same boundaries as BlockEngine, except special opcodes are left to the
+    // interpreter and a conditional branch does not end the block.
+    vector<Step> steps;
+    long_t addr = start;
+    long_t span = 0;
+    while (addr - start < MaxBlockWords) {
+        Step step;
+        step.m_addr = static_cast<word_t>(addr);
+        Predecode(mem, step.m_addr, step.m_entry);
+        const Instruction& inst = step.m_entry.m_instruction;
+        if (step.m_entry.m_cycles == 0 || inst.m_opcode == OpCode_Special
+            || addr + step.m_entry.m_span > Memory::LastValidAddress + 1) {
+            break;
+        }
+        const bool isConditionalBranch = !steps.empty() && isConditionalOpCode(steps.back().m_entry.m_instruction.m_opcode);
+        steps.push_back(step);
+        span = std::max<long_t>(span, addr - start + step.m_entry.m_span);
+        addr += step.m_entry.m_wordCount;
+        if (IsBranch(inst) && !isConditionalBranch)
+            break;
+    }
+    if (steps.empty())
+        return;
+
+    for (size_t i=0; i<steps.size(); ++i) {
+        Step& step = steps[i];
+        if (!isConditionalOpCode(step.m_entry.m_instruction.m_opcode))
+            continue;
+        for (size_t j=i+1; j<steps.size(); ++j) {
+            if (steps[j].m_addr == step.m_entry.m_skipTarget) {
+                step.m_skipIndex = static_cast<int>(j);
+                break;
+            }
+        }
+    }
+
+#if DCPU_DIRTY_TRACKING
+    byte_t* dirtyPages = mem.m_dirtyPages;
+#else
+    byte_t* dirtyPages = nullptr;
+#endif
+    Translator translator(steps, start, addr, mem.m_watched, dirtyPages);
+    const vector<byte_t> code = translator.translate();
+    if (m_codeUsed + code.size() > CodeBufferBytes) {
+        clearBlocks();
+    }
+    if (code.size() > CodeBufferBytes)
+        return;
+
+    mprotect(m_code, CodeBufferBytes, PROT_READ | PROT_WRITE);
+    std::memcpy(m_code + m_codeUsed, code.data(), code.size());
+    mprotect(m_code, CodeBufferBytes, PROT_READ | PROT_EXEC);
+
+    std::unique_ptr<Block> block = std::make_unique<Block>();
+    block->m_code = reinterpret_cast<Code>(m_code + m_codeUsed);
+    block->m_start = start;
+    block->m_end = addr;
+    block->m_span = static_cast<word_t>(std::min<long_t>(span, Memory::LastValidAddress));
+    block->m_stepCount = static_cast<word_t>(steps.size());
+    block->m_maxCycles = MaxCycles(steps);
+    m_codeUsed += (code.size() + 15) & ~size_t{15};
+
+    m_blockMaxSpan = std::max(m_blockMaxSpan, block->m_span);
+    mem.Watch(start, block->m_span);
+    m_blocks[start] = std::move(block);
+#endif
+}
+
+void JitEngine::invalidateBlocks(word_t addr) {
+    for (word_t i=0; i<m_blockMaxSpan; ++i) {
+        const word_t start = addr - i;
+        const Block* block = m_blocks[start].get();
+        if (block != nullptr && block->m_span > i) {
+            m_blocks[start].reset();
+            m_counters[start] = 0;
+        }
+    }
+}
+
+void JitEngine::clearBlocks() {
+    for (std::unique_ptr<Block>& block : m_blocks) {
+        block.reset();
+    }
+    std::fill(m_counters.begin(), m_counters.end(), 0);
+    m_blockMaxSpan = 0;
+    m_codeUsed = 0;
+}
+
+void JitEngine::onMemoryWrite(word_t addr) {
+    SpecializedEngine::onMemoryWrite(addr);
+    invalidateBlocks(addr);
+}
+
+void JitEngine::onMemoryDetached() {
+    SpecializedEngine::onMemoryDetached();
+    clearBlocks();
+}
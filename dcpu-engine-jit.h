@@ -0,0 +1,80 @@
+#pragma once
+#include <dcpu-engine.h>
+#include <dcpu-engine-specialized.h>
+#include <dcpu-mem.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+using std::vector;
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define DCPU_JIT_SUPPORTED 1
+#else
+#define DCPU_JIT_SUPPORTED 0
+#endif
+
+//
+// Translates hot basic blocks to x86-64 code. Execution counters are kept per
+// address for the targets of jumps, once a target reaches HotThreshold the
+// block starting there is compiled. Everything else (cold code, special
+// opcodes, interrupt delivery) runs through the SpecializedEngine handlers.
+//
+// Compiled code keeps the eight registers plus SP and EX in host registers.
+// It leaves as soon as a store hits a watched word, the store is then
+// reported to the memory observers from here, so translations of written code
+// are dropped before running again. On other hosts no block is ever compiled.
+//
+class JitEngine : public SpecializedEngine {
+public:
+    static constexpr uint32_t HotThreshold = 32;
+    static constexpr word_t MaxBlockWords = 64;
+    static constexpr size_t CodeBufferBytes = 4 << 20;
+
+    JitEngine();
+    ~JitEngine();
+    long_t execute(DCPU& cpu, Memory& mem, long_t maxInstructions, cycles_t maxCycles) override;
+
+    void onMemoryWrite(word_t addr) override;
+    void onMemoryDetached() override;
+
+    // state exchanged with the compiled code, layout is known to the emitter
+    struct Context {
+        word_t m_registers[8];
+        word_t m_sp;
+        word_t m_ex;
+        word_t m_pc;
+        word_t m_touchAddr;
+        uint32_t m_touched;
+        uint32_t m_cycles;
+        uint32_t m_executed;
+        uint32_t m_budget;
+        uint32_t m_cycleBudget;
+        word_t* m_memory;
+    };
+    using Code = void(*)(Context* context);
+
+private:
+    struct Block {
+        Code m_code = nullptr;
+        word_t m_start = 0;
+        long_t m_end = 0;               // address after the last instruction
+        word_t m_span = 0;              // words the translation depends on
+        word_t m_stepCount = 0;         // most instructions run per pass
+        cycles_t m_maxCycles = 0;       // most cycles charged per pass
+    };
+
+    void compile(Memory& mem, word_t start);
+    long_t run(DCPU& cpu, Memory& mem, const Block& block, long_t budget, cycles_t cycleBudget);
+    void invalidateBlocks(word_t addr);
+    void clearBlocks();
+
+    vector<std::unique_ptr<Block>> m_blocks;    // keyed by start address
+    vector<uint32_t> m_counters;
+    word_t m_blockMaxSpan = 0;
+    long_t m_nextPC = 0;                        // pc following the last instruction run
+    Context m_context;
+
+    byte_t* m_code = nullptr;                   // executable buffer, filled linearly
+    size_t m_codeUsed = 0;
+};
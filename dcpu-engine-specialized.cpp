@@ -0,0 +1,309 @@
+#include <dcpu-engine-specialized.h>
+#include <dcpu-codex.h>
+#include <dcpu.h>
+
+namespace {
+    constexpr bool IsValidOpCode(OpCode op) {
+        switch (op) {
+        case OpCode_SET: case OpCode_ADD: case OpCode_SUB: case OpCode_MUL:
+        case OpCode_MLI: case OpCode_DIV: case OpCode_DVI: case OpCode_MOD:
+        case OpCode_MDI: case OpCode_AND: case OpCode_BOR: case OpCode_XOR:
+        case OpCode_SHR: case OpCode_ASR: case OpCode_SHL: case OpCode_IFB:
+        case OpCode_IFC: case OpCode_IFE: case OpCode_IFN: case OpCode_IFG:
+        case OpCode_IFA: case OpCode_IFL: case OpCode_IFU: case OpCode_ADX:
+        case OpCode_SBX: case OpCode_STI: case OpCode_STD:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    constexpr bool IsMemoryOperand(OperandKind kind) {
+        switch (kind) {
+        case OperandKind_Ref: case OperandKind_RefNext: case OperandKind_PushPop:
+        case OperandKind_Peek: case OperandKind_Pick: case OperandKind_Next:
+            return true;
+        default:
+            return false;
+        }
+    }
+}
+
+template<size_t Index, bool WriteEX>
+constexpr SpecializedEngine::Handler SpecializedEngine::MakeHandler() {
+    constexpr OpCode op = static_cast<OpCode>(Index / (OperandKind_Count * OperandKind_Count));
+    constexpr OperandKind b = static_cast<OperandKind>((Index / OperandKind_Count) % OperandKind_Count);
+    constexpr OperandKind a = static_cast<OperandKind>(Index % OperandKind_Count);
+    if constexpr (!IsValidOpCode(op) || b == OperandKind_None || a == OperandKind_None) {
+        return &Fallback;
+    } else if constexpr (!WriteEX && !overwritesEX(op)) {
+        return nullptr;
+    } else {
+        return &Execute<op, b, a, WriteEX>;
+    }
+}
+
+template<bool WriteEX, size_t... Indices>
+constexpr auto SpecializedEngine::MakeTable(std::index_sequence<Indices...>) -> std::array<Handler, HandlerCount> {
+    return {{ MakeHandler<Indices, WriteEX>()... }};
+}
+
+template<OperandKind Kind, bool IsA>
+inline word_t& SpecializedEngine::Resolve(DCPU& cpu, Memory& mem, const Operand& operand, word_t& literal) {
+    if constexpr (Kind == OperandKind_Register) {
+        return cpu.m_registers[operand.m_register];
+    } else if constexpr (Kind == OperandKind_Ref) {
+        return mem[cpu.m_registers[operand.m_register]];
+    } else if constexpr (Kind == OperandKind_RefNext) {
+        return mem[static_cast<word_t>(cpu.m_registers[operand.m_register] + operand.m_word)];
+    } else if constexpr (Kind == OperandKind_PushPop) {
+        if constexpr (IsA) {
+            return mem[cpu.m_sp++];
+        } else {
+            return mem[--cpu.m_sp];
+        }
+    } else if constexpr (Kind == OperandKind_Peek) {
+        return mem[cpu.m_sp];
+    } else if constexpr (Kind == OperandKind_Pick) {
+        return mem[static_cast<word_t>(cpu.m_sp + operand.m_word)];
+    } else if constexpr (Kind == OperandKind_SP) {
+        return cpu.m_sp;
+    } else if constexpr (Kind == OperandKind_PC) {
+        return cpu.m_pc;
+    } else if constexpr (Kind == OperandKind_EX) {
+        return cpu.m_ex;
+    } else if constexpr (Kind == OperandKind_Next) {
+        return mem[operand.m_word];
+    } else {
+        static_assert(Kind == OperandKind_Literal, "unhandled operand kind");
+        literal = operand.m_word;
+        return literal;
+    }
+}
+
+template<OpCode Op, OperandKind B, OperandKind A, bool WriteEX>
+cycles_t SpecializedEngine::Execute(DCPU& cpu, Memory& mem, const Entry& entry) {
+    word_t literalA = 0;
+    word_t literalB = 0;
+    word_t& a = Resolve<A, true>(cpu, mem, entry.m_a, literalA);
+    word_t& b = Resolve<B, false>(cpu, mem, entry.m_b, literalB);
+    word_t discardedEX = 0;
+    word_t& ex = WriteEX ? cpu.m_ex : discardedEX;
+    cycles_t cycles = entry.m_cycles;
+    bool skip = false;
+
+    if constexpr (Op == OpCode_SET) {
+        b = a;
+    } else if constexpr (Op == OpCode_ADD) {
+        word_t res = b + a;
+        b = res;
+        ex = (res < a || res < b) ? 1 : 0;
+    } else if constexpr (Op == OpCode_SUB) {
+        word_t bval = b;
+        word_t res = bval - a;
+        b = res;
+        ex = res > bval ? 0xFFFF : 0;
+    } else if constexpr (Op == OpCode_MUL) {
+        long_t res = b * a;
+        b = static_cast<word_t>(0xFFFF & res);
+        ex = static_cast<word_t>((res>>16) & 0xFFFF);
+    } else if constexpr (Op == OpCode_MLI) {
+        long_t res = b * a;
+        b = static_cast<word_t>(0xFFFF & res);
+        ex = static_cast<signed_word_t>((res>>16) & 0xFFFF);
+    } else if constexpr (Op == OpCode_DIV) {
+        if (a == 0) {
+            b = ex = 0;
+        } else {
+            word_t bval = b;
+            long_t res = bval / a;
+            b = static_cast<word_t>(0xFFFF & res);
+            ex = static_cast<word_t>(((static_cast<long_t>(bval) << 16) / a) & 0xFFFF);
+        }
+    } else if constexpr (Op == OpCode_DVI) {
+        if (a == 0) {
+            b = ex = 0;
+        } else {
+            long_t res = static_cast<long_t>(b) / static_cast<long_t>(a);
+            b = static_cast<word_t>(0xFFFF & res);
+            ex = static_cast<word_t>(((b << 16) / a) & 0xFFFF);
+        }
+    } else if constexpr (Op == OpCode_MOD) {
+        if (a == 0) {
+            b = ex = 0;
+        } else {
+            b = b % a;
+        }
+    } else if constexpr (Op == OpCode_MDI) {
+        if (a == 0) {
+            b = ex = 0;
+        } else {
+            b = static_cast<word_t>(static_cast<signed_word_t>(b) % static_cast<signed_word_t>(a));
+        }
+    } else if constexpr (Op == OpCode_AND) {
+        b = b & a;
+    } else if constexpr (Op == OpCode_BOR) {
+        b = b | a;
+    } else if constexpr (Op == OpCode_XOR) {
+        b = b ^ a;
+    } else if constexpr (Op == OpCode_SHR) {
+        const word_t bval = b;
+        b = static_cast<word_t>(static_cast<uint64_t>(bval) >> ShiftCount(a));
+        ex = ((static_cast<uint64_t>(bval)<<16) >> ShiftCount(a)) & 0xFFFF;
+    } else if constexpr (Op == OpCode_ASR) {
+        const word_t bval = b;
+        b = static_cast<word_t>(static_cast<int64_t>(static_cast<signed_word_t>(bval)) >> ShiftCount(a));
+        ex = ((static_cast<uint64_t>(bval)<<16) >> ShiftCount(a)) & 0xFFFF;
+    } else if constexpr (Op == OpCode_SHL) {
+        const word_t bval = b;
+        b = static_cast<word_t>(static_cast<uint64_t>(bval) << ShiftCount(a));
+        ex = ((static_cast<uint64_t>(bval) << ShiftCount(a)) >> 16) & 0xFFFF;
+    } else if constexpr (Op == OpCode_IFB) {
+        skip = (b & a) == 0;
+    } else if constexpr (Op == OpCode_IFC) {
+        skip = (b & a) != 0;
+    } else if constexpr (Op == OpCode_IFE) {
+        skip = b != a;
+    } else if constexpr (Op == OpCode_IFN) {
+        skip = b == a;
+    } else if constexpr (Op == OpCode_IFG) {
+        skip = b <= a;
+    } else if constexpr (Op == OpCode_IFA) {
+        skip = static_cast<signed_word_t>(b) <= static_cast<signed_word_t>(a);
+    } else if constexpr (Op == OpCode_IFL) {
+        skip = b >= a;
+    } else if constexpr (Op == OpCode_IFU) {
+        skip = static_cast<signed_word_t>(b) >= static_cast<signed_word_t>(a);
+    } else if constexpr (Op == OpCode_ADX) {
+        long_t res = b + a + ex;
+        b = res & 0xFFFF;
+        ex = (res >> 16) & 0xFFFF;
+    } else if constexpr (Op == OpCode_SBX) {
+        word_t bval = b;
+        word_t res = bval - a + ex;
+        b = res;
+        ex = res > bval ? 0xFFFF : 0;
+    } else if constexpr (Op == OpCode_STI) {
+        b = a;
+        ++cpu.m_registers[Registers_I];
+        ++cpu.m_registers[Registers_J];
+    } else if constexpr (Op == OpCode_STD) {
+        b = a;
+        --cpu.m_registers[Registers_I];
+        --cpu.m_registers[Registers_J];
+    }
+
+    if constexpr (isConditionalOpCode(Op)) {
+        if (skip) {
+            cpu.m_pc = entry.m_skipTarget;
+            cycles += entry.m_skipCycles;
+        }
+    } else if constexpr (IsMemoryOperand(B)) {
+        mem.Touch(&b);
+    }
+    return cycles;
+}
+
+cycles_t SpecializedEngine::Fallback(DCPU& cpu, Memory& mem, const Entry& entry) {
+    Instruction instruction = entry.m_instruction;
+    return cpu.eval(mem, instruction);
+}
+
+const std::array<SpecializedEngine::Handler, SpecializedEngine::HandlerCount> SpecializedEngine::s_handlers =
+    SpecializedEngine::MakeTable<true>(std::make_index_sequence<SpecializedEngine::HandlerCount>());
+const std::array<SpecializedEngine::Handler, SpecializedEngine::HandlerCount> SpecializedEngine::s_handlersNoEX =
+    SpecializedEngine::MakeTable<false>(std::make_index_sequence<SpecializedEngine::HandlerCount>());
+
+SpecializedEngine::Handler SpecializedEngine::GetHandler(OpCode op, OperandKind b, OperandKind a, bool writeEX) {
+    const size_t index = (op * OperandKind_Count + b) * OperandKind_Count + a;
+    return writeEX ? s_handlers[index] : s_handlersNoEX[index];
+}
+
+SpecializedEngine::SpecializedEngine()
+    : m_entries(Memory::LastValidAddress+1)
+{
+}
+
+long_t SpecializedEngine::execute(DCPU& cpu, Memory& mem, long_t maxInstructions, cycles_t maxCycles) {
+    if (!isAttachedTo(mem)) {
+        clear();
+        attach(mem);
+    }
+    const cycles_t startCycles = cpu.m_cycles;
+    long_t executed = 0;
+    while (executed < maxInstructions && cpu.m_cycles - startCycles < maxCycles && cpu.m_pc < cpu.m_pcLimit) {
+        const word_t originalPC = cpu.m_pc;
+        const Entry& entry = m_entries[originalPC];
+        if (entry.m_handler == nullptr)
+            predecode(mem, originalPC);
+        const bool isFallback = IsFallback(entry);
+        const cycles_t cycles = entry.m_handler(cpu, mem, entry);
+        if (cpu.m_pc == originalPC)
+            cpu.m_pc += entry.m_wordCount;
+        cpu.m_cycles += cycles;
+        ++executed;
+        if (isFallback)
+            break;
+    }
+    return executed;
+}
+
+void SpecializedEngine::Predecode(Memory& mem, word_t addr, Entry& outEntry) {
+    Entry& entry = outEntry;
+    entry.m_instruction = Codex::Decode(mem+addr, mem.LastValidAddress-addr);
+    const Instruction& inst = entry.m_instruction;
+    entry.m_wordCount = inst.WordCount();
+    entry.m_cycles = inst.BaseCycles();
+    entry.m_span = entry.m_wordCount;
+    entry.m_skipTarget = 0;
+    entry.m_skipCycles = 0;
+
+    OperandKind a = OperandKind_None;
+    OperandKind b = OperandKind_None;
+    if (inst.m_opcode != OpCode_Special && entry.m_cycles != 0) {
+        a = GetOperandKind(inst.m_a, true, inst.m_wordA, entry.m_a.m_word, entry.m_a.m_register);
+        b = GetOperandKind(inst.m_b, false, inst.m_wordB, entry.m_b.m_word, entry.m_b.m_register);
+    }
+    entry.m_handler = GetHandler(inst.m_opcode, b, a, true);
+
+    if (isConditionalOpCode(inst.m_opcode)) {
+        // same walk as GetNextCodeAddressSkipIF, done once
+        word_t nextPC = addr + entry.m_wordCount;
+        bool foundNext = false;
+        while (!foundNext) {
+            const Instruction skipped = Codex::Decode(mem+nextPC, mem.LastValidAddress-nextPC);
+            nextPC += skipped.WordCount();
+            ++entry.m_skipCycles;
+            foundNext = !isConditionalOpCode(skipped.m_opcode);
+        }
+        entry.m_skipTarget = nextPC;
+        entry.m_span = nextPC - addr;
+    }
+}
+
+void SpecializedEngine::predecode(Memory& mem, word_t addr) {
+    Entry& entry = m_entries[addr];
+    Predecode(mem, addr, entry);
+    m_maxSpan = std::max(m_maxSpan, entry.m_span);
+    mem.Watch(addr, entry.m_span);
+}
+
+void SpecializedEngine::clear() {
+    for (Entry& entry : m_entries) {
+        entry.m_handler = nullptr;
+    }
+}
+
+void SpecializedEngine::onMemoryWrite(word_t addr) {
+    // conditionals also cover the instructions they may skip
+    for (word_t i=0; i<m_maxSpan; ++i) {
+        Entry& entry = m_entries[static_cast<word_t>(addr - i)];
+        if (entry.m_handler != nullptr && entry.m_span > i) {
+            entry.m_handler = nullptr;
+        }
+    }
+}
+
+void SpecializedEngine::onMemoryDetached() {
+    clear();
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <dcpu-engine.h>
+#include <dcpu-mem.h>
+#include <array>
+#include <utility>
+#include <vector>
+
+using std::vector;
+
+//
+// Interpreter built on a compile time table of handlers, one per
+// (opcode, b operand kind, a operand kind) combination. Each handler has its
+// operand accesses resolved statically, register to register operations end
+// up as a few host instructions. Special opcodes are forwarded to DCPU::eval.
+//
+class SpecializedEngine : public ExecutionEngine, public MemoryObserver {
+public:
+    SpecializedEngine();
+    long_t execute(DCPU& cpu, Memory& mem, long_t maxInstructions, cycles_t maxCycles) override;
+
+    void onMemoryWrite(word_t addr) override;
+    void onMemoryDetached() override;
+
+    struct Operand {
+        word_t m_word = 0;          // literal value or next word offset
+        byte_t m_register = 0;
+    };
+    struct Entry;
+    using Handler = cycles_t(*)(DCPU& cpu, Memory& mem, const Entry& entry);
+    struct Entry {
+        Handler m_handler = nullptr;    // nullptr when not predecoded
+        Operand m_a;
+        Operand m_b;
+        Instruction m_instruction;
+        cycles_t m_cycles = 0;
+        byte_t m_wordCount = 0;
+        word_t m_span = 0;              // words the entry was decoded from
+        word_t m_skipTarget = 0;        // conditionals only, pc when the test fails
+        cycles_t m_skipCycles = 0;
+    };
+
+    // Fills entry with the instruction at addr, conditionals get their skip
+    // target resolved from the instructions following them.
+    static void Predecode(Memory& mem, word_t addr, Entry& outEntry);
+    static bool IsFallback(const Entry& entry) { return entry.m_handler == &Fallback; }
+    // Handler for the given operand kinds, writeEX false gives a variant that
+    // leaves EX untouched (nullptr unless overwritesEX(op))
+    static Handler GetHandler(OpCode op, OperandKind b, OperandKind a, bool writeEX);
+
+private:
+    template<OperandKind Kind, bool IsA>
+    static word_t& Resolve(DCPU& cpu, Memory& mem, const Operand& operand, word_t& literal);
+    template<OpCode Op, OperandKind B, OperandKind A, bool WriteEX>
+    static cycles_t Execute(DCPU& cpu, Memory& mem, const Entry& entry);
+    static cycles_t Fallback(DCPU& cpu, Memory& mem, const Entry& entry);
+    static constexpr size_t HandlerCount = OpCode_Count * OperandKind_Count * OperandKind_Count;
+    template<size_t Index, bool WriteEX>
+    static constexpr Handler MakeHandler();
+    template<bool WriteEX, size_t... Indices>
+    static constexpr std::array<Handler, HandlerCount> MakeTable(std::index_sequence<Indices...>);
+    static const std::array<Handler, HandlerCount> s_handlers;
+    static const std::array<Handler, HandlerCount> s_handlersNoEX;
+
+protected:
+    void predecode(Memory& mem, word_t addr);
+    void clear();
+
+    vector<Entry> m_entries;
+    word_t m_maxSpan = 0;
+};
@@ -0,0 +1,357 @@
+#include <dcpu-engine-threaded.h>
+#include <dcpu-codex.h>
+#include <dcpu.h>
+
+ThreadedEngine::ThreadedEngine()
+    : m_entries(Memory::LastValidAddress+1)
+    , m_labels{nullptr, nullptr, nullptr, nullptr}
+{
+}
+
+long_t ThreadedEngine::execute(DCPU& cpu, Memory& mem, long_t maxInstructions, cycles_t maxCycles) {
+    if (!isAttachedTo(mem)) {
+        clear();
+        attach(mem);
+    }
+    if (m_labels.m_opcodes == nullptr) {
+        run(cpu, mem, 0, 0, &m_labels);
+    }
+    return run(cpu, mem, maxInstructions, maxCycles, nullptr);
+}
+
+void ThreadedEngine::predecode(Memory& mem, word_t addr) {
+    Entry& entry = m_entries[addr];
+    entry.m_instruction = Codex::Decode(mem+addr, mem.LastValidAddress-addr);
+    const Instruction& inst = entry.m_instruction;
+    entry.m_wordCount = inst.WordCount();
+    entry.m_cycles = inst.BaseCycles();
+
+    if (inst.m_opcode == OpCode_Special || entry.m_cycles == 0) {
+        entry.m_handler = m_labels.m_fallback;
+        entry.m_a.m_fetch = m_labels.m_fetchA[OperandKind_None];
+        entry.m_b.m_fetch = m_labels.m_fetchB[OperandKind_None];
+    } else {
+        const OperandKind a = GetOperandKind(inst.m_a, true, inst.m_wordA, entry.m_a.m_word, entry.m_a.m_register);
+        const OperandKind b = GetOperandKind(inst.m_b, false, inst.m_wordB, entry.m_b.m_word, entry.m_b.m_register);
+        entry.m_handler = m_labels.m_opcodes[inst.m_opcode];
+        entry.m_a.m_fetch = m_labels.m_fetchA[a];
+        entry.m_b.m_fetch = m_labels.m_fetchB[b];
+    }
+    mem.Watch(addr, entry.m_wordCount);
+}
+
+word_t ThreadedEngine::skipConditionals(Memory& mem, word_t addr, cycles_t& outSkippedCount) {
+    word_t nextPC = addr;
+    bool foundNext = false;
+    while (!foundNext) {
+        if (m_entries[nextPC].m_handler == nullptr)
+            predecode(mem, nextPC);
+        const Entry& entry = m_entries[nextPC];
+        nextPC += entry.m_wordCount;
+        ++outSkippedCount;
+        foundNext = !isConditionalOpCode(entry.m_instruction.m_opcode);
+    }
+    return nextPC;
+}
+
+void ThreadedEngine::clear() {
+    for (Entry& entry : m_entries) {
+        entry.m_handler = nullptr;
+    }
+}
+
+void ThreadedEngine::onMemoryWrite(word_t addr) {
+    for (word_t i=0; i<3; ++i) {
+        Entry& entry = m_entries[static_cast<word_t>(addr - i)];
+        if (entry.m_handler != nullptr && entry.m_wordCount > i) {
+            entry.m_handler = nullptr;
+        }
+    }
+}
+
+void ThreadedEngine::onMemoryDetached() {
+    clear();
+}
+
+#if defined(__GNUC__)
+
+// label addresses are stored in the predecoded entries across calls, the
+// function must not be inlined nor cloned for them to stay valid.
+#if defined(__clang__)
+__attribute__((noinline))
+#else
+__attribute__((noinline, noclone))
+#endif
+long_t ThreadedEngine::run(DCPU& cpu, Memory& mem, long_t maxInstructions, cycles_t maxCycles, Labels* outLabels) {
+    static const void* const opcodes[OpCode_Count] = {
+        &&op_fallback, &&op_set, &&op_add, &&op_sub, &&op_mul, &&op_mli, &&op_div, &&op_dvi,
+        &&op_mod, &&op_mdi, &&op_and, &&op_bor, &&op_xor, &&op_shr, &&op_asr, &&op_shl,
+        &&op_ifb, &&op_ifc, &&op_ife, &&op_ifn, &&op_ifg, &&op_ifa, &&op_ifl, &&op_ifu,
+        &&op_fallback, &&op_fallback, &&op_adx, &&op_sbx, &&op_fallback, &&op_fallback, &&op_sti, &&op_std,
+    };
+    static const void* const fetchA[OperandKind_Count] = {
+        &&a_register, &&a_ref, &&a_refnext, &&a_pushpop, &&a_peek, &&a_pick,
+        &&a_sp, &&a_pc, &&a_ex, &&a_next, &&a_literal, &&a_none,
+    };
+    static const void* const fetchB[OperandKind_Count] = {
+        &&b_register, &&b_ref, &&b_refnext, &&b_pushpop, &&b_peek, &&b_pick,
+        &&b_sp, &&b_pc, &&b_ex, &&b_next, &&b_literal, &&b_none,
+    };
+    static_assert(OpCode_Count == 0x20, "Please update this when changing opcodes");
+
+    if (outLabels != nullptr) {
+        *outLabels = Labels{opcodes, fetchA, fetchB, opcodes[OpCode_Special]};
+        return 0;
+    }
+
+    word_t* const regs = cpu.m_registers;
+    const cycles_t startCycles = cpu.m_cycles;
+    long_t executed = 0;
+    Entry* inst = nullptr;
+    word_t originalPC = 0;
+    cycles_t cycles = 0;
+    word_t* a = nullptr;
+    word_t* b = nullptr;
+    word_t literalA = 0;
+    word_t literalB = 0;
+
+#define DISPATCH()                                              \
+    if (executed == maxInstructions || cpu.m_pc >= cpu.m_pcLimit \
+        || cpu.m_cycles - startCycles >= maxCycles)             \
+        return executed;                                        \
+    originalPC = cpu.m_pc;                                      \
+    inst = &m_entries[originalPC];                              \
+    if (inst->m_handler == nullptr)                             \
+        predecode(mem, originalPC);                             \
+    cycles = inst->m_cycles;                                    \
+    goto *inst->m_a.m_fetch;
+
+#define FETCHED_A() goto *inst->m_b.m_fetch
+#define FETCHED_B() goto *inst->m_handler
+
+#define ADVANCE()                                               \
+    if (cpu.m_pc == originalPC)                                 \
+        cpu.m_pc += inst->m_wordCount;                          \
+    cpu.m_cycles += cycles;                                     \
+    ++executed;
+
+#define RETIRE()                                                \
+    ADVANCE()                                                   \
+    DISPATCH()
+
+#define RETIRE_WRITE()                                          \
+    mem.Touch(b);                                               \
+    RETIRE()
+
+#define SKIP_IF(cond)                                           \
+    if (cond) {                                                 \
+        cycles_t skippedCount = 0;                              \
+        cpu.m_pc = skipConditionals(mem, originalPC + inst->m_wordCount, skippedCount); \
+        cycles += skippedCount;                                 \
+    }                                                           \
+    RETIRE()
+
+    DISPATCH();
+
+ a_register: a = regs + inst->m_a.m_register; FETCHED_A();
+ a_ref:      a = mem + regs[inst->m_a.m_register]; FETCHED_A();
+ a_refnext:  a = mem + static_cast<word_t>(regs[inst->m_a.m_register] + inst->m_a.m_word); FETCHED_A();
+ a_pushpop:  a = mem + (cpu.m_sp++); FETCHED_A();
+ a_peek:     a = mem + cpu.m_sp; FETCHED_A();
+ a_pick:     a = mem + static_cast<word_t>(cpu.m_sp + inst->m_a.m_word); FETCHED_A();
+ a_sp:       a = &cpu.m_sp; FETCHED_A();
+ a_pc:       a = &cpu.m_pc; FETCHED_A();
+ a_ex:       a = &cpu.m_ex; FETCHED_A();
+ a_next:     a = mem + inst->m_a.m_word; FETCHED_A();
+ a_literal:  literalA = inst->m_a.m_word; a = &literalA; FETCHED_A();
+ a_none:     FETCHED_A();
+
+ b_register: b = regs + inst->m_b.m_register; FETCHED_B();
+ b_ref:      b = mem + regs[inst->m_b.m_register]; FETCHED_B();
+ b_refnext:  b = mem + static_cast<word_t>(regs[inst->m_b.m_register] + inst->m_b.m_word); FETCHED_B();
+ b_pushpop:  b = mem + (--cpu.m_sp); FETCHED_B();
+ b_peek:     b = mem + cpu.m_sp; FETCHED_B();
+ b_pick:     b = mem + static_cast<word_t>(cpu.m_sp + inst->m_b.m_word); FETCHED_B();
+ b_sp:       b = &cpu.m_sp; FETCHED_B();
+ b_pc:       b = &cpu.m_pc; FETCHED_B();
+ b_ex:       b = &cpu.m_ex; FETCHED_B();
+ b_next:     b = mem + inst->m_b.m_word; FETCHED_B();
+ b_literal:  literalB = inst->m_b.m_word; b = &literalB; FETCHED_B();
+ b_none:     FETCHED_B();
+
+ op_fallback: {
+        Instruction instruction = inst->m_instruction;
+        cycles = cpu.eval(mem, instruction);
+    }
+    ADVANCE();
+    return executed;
+
+ op_set:
+    *b = *a;
+    RETIRE_WRITE();
+
+ op_add: {
+        word_t res = *b + *a;
+        *b = res;
+        cpu.m_ex = (res < *a || res < *b) ? 1 : 0;
+    }
+    RETIRE_WRITE();
+
+ op_sub: {
+        word_t bval = *b;
+        word_t res = bval - *a;
+        *b = res;
+        cpu.m_ex = res > bval ? 0xFFFF : 0;
+    }
+    RETIRE_WRITE();
+
+ op_mul: {
+        long_t res = *b * *a;
+        *b = static_cast<word_t>(0xFFFF & res);
+        cpu.m_ex = static_cast<word_t>((res>>16) & 0xFFFF);
+    }
+    RETIRE_WRITE();
+
+ op_mli: {
+        long_t res = *b * *a;
+        *b = static_cast<word_t>(0xFFFF & res);
+        cpu.m_ex = static_cast<signed_word_t>((res>>16) & 0xFFFF);
+    }
+    RETIRE_WRITE();
+
+ op_div:
+    if (*a == 0) {
+        *b = cpu.m_ex = 0;
+    } else {
+        word_t bval = *b;
+        long_t res = bval / *a;
+        *b = static_cast<word_t>(0xFFFF & res);
+        cpu.m_ex = static_cast<word_t>(((static_cast<long_t>(bval) << 16) / *a) & 0xFFFF);
+    }
+    RETIRE_WRITE();
+
+ op_dvi:
+    if (*a == 0) {
+        *b = cpu.m_ex = 0;
+    } else {
+        long_t res = static_cast<long_t>(*b) / static_cast<long_t>(*a);
+        *b = static_cast<word_t>(0xFFFF & res);
+        cpu.m_ex = static_cast<word_t>(((*b << 16) / *a) & 0xFFFF);
+    }
+    RETIRE_WRITE();
+
+ op_mod:
+    if (*a == 0) {
+        *b = cpu.m_ex = 0;
+    } else {
+        *b = *b % *a;
+    }
+    RETIRE_WRITE();
+
+ op_mdi:
+    if (*a == 0) {
+        *b = cpu.m_ex = 0;
+    } else {
+        *b = static_cast<word_t>(static_cast<signed_word_t>(*b) % static_cast<signed_word_t>(*a));
+    }
+    RETIRE_WRITE();
+
+ op_and:
+    *b = *b & *a;
+    RETIRE_WRITE();
+
+ op_bor:
+    *b = *b | *a;
+    RETIRE_WRITE();
+
+ op_xor:
+    *b = *b ^ *a;
+    RETIRE_WRITE();
+
+ op_shr: {
+        const word_t bval = *b;
+        *b = static_cast<word_t>(static_cast<uint64_t>(bval) >> ShiftCount(*a));
+        cpu.m_ex = ((static_cast<uint64_t>(bval)<<16) >> ShiftCount(*a)) & 0xFFFF;
+    }
+    RETIRE_WRITE();
+
+ op_asr: {
+        const word_t bval = *b;
+        *b = static_cast<word_t>(static_cast<int64_t>(static_cast<signed_word_t>(bval)) >> ShiftCount(*a));
+        cpu.m_ex = ((static_cast<uint64_t>(bval)<<16) >> ShiftCount(*a)) & 0xFFFF;
+    }
+    RETIRE_WRITE();
+
+ op_shl: {
+        const word_t bval = *b;
+        *b = static_cast<word_t>(static_cast<uint64_t>(bval) << ShiftCount(*a));
+        cpu.m_ex = ((static_cast<uint64_t>(bval) << ShiftCount(*a)) >> 16) & 0xFFFF;
+    }
+    RETIRE_WRITE();
+
+ op_ifb: SKIP_IF((*b & *a) == 0);
+ op_ifc: SKIP_IF((*b & *a) != 0);
+ op_ife: SKIP_IF(*b != *a);
+ op_ifn: SKIP_IF(*b == *a);
+ op_ifg: SKIP_IF(*b <= *a);
+ op_ifa: SKIP_IF(static_cast<signed_word_t>(*b) <= static_cast<signed_word_t>(*a));
+ op_ifl: SKIP_IF(*b >= *a);
+ op_ifu: SKIP_IF(static_cast<signed_word_t>(*b) >= static_cast<signed_word_t>(*a));
+
+ op_adx: {
+        long_t res = *b + *a + cpu.m_ex;
+        *b = res & 0xFFFF;
+        cpu.m_ex = (res >> 16) & 0xFFFF;
+    }
+    RETIRE_WRITE();
+
+ op_sbx: {
+        word_t bval = *b;
+        word_t res = bval - *a + cpu.m_ex;
+        *b = res;
+        cpu.m_ex = res > bval ? 0xFFFF : 0;
+    }
+    RETIRE_WRITE();
+
+ op_sti:
+    *b = *a;
+    ++regs[Registers_I];
+    ++regs[Registers_J];
+    RETIRE_WRITE();
+
+ op_std:
+    *b = *a;
+    --regs[Registers_I];
+    --regs[Registers_J];
+    RETIRE_WRITE();
+
+#undef DISPATCH
+#undef FETCHED_A
+#undef FETCHED_B
+#undef ADVANCE
+#undef RETIRE
+#undef RETIRE_WRITE
+#undef SKIP_IF
+}
+
+#else
+
+// no labels as values, behave as the reference interpreter.
+long_t ThreadedEngine::run(DCPU& cpu, Memory& mem, long_t maxInstructions, cycles_t maxCycles, Labels* outLabels) {
+    if (outLabels != nullptr) {
+        *outLabels = Labels{nullptr, nullptr, nullptr, nullptr};
+        return 0;
+    }
+    const cycles_t startCycles = cpu.m_cycles;
+    long_t executed = 0;
+    while (executed < maxInstructions && cpu.m_cycles - startCycles < maxCycles && cpu.m_pc < cpu.m_pcLimit) {
+        const bool isSpecialOp = (mem[cpu.m_pc] & 0x1F) == OpCode_Special;
+        cpu.interpret(mem);
+        ++executed;
+        if (isSpecialOp)
+            break;
+    }
+    return executed;
+}
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+#include <dcpu-engine.h>
+#include <dcpu-mem.h>
+#include <vector>
+
+using std::vector;
+
+//
+// Direct threaded interpreter: instructions are predecoded into the address
+// of their opcode handler and of the code fetching each of their operands,
+// dispatch is then done with computed gotos (labels as values, gcc/clang).
+// Special opcodes are forwarded to DCPU::eval.
+//
+class ThreadedEngine : public ExecutionEngine, public MemoryObserver {
+public:
+    ThreadedEngine();
+    long_t execute(DCPU& cpu, Memory& mem, long_t maxInstructions, cycles_t maxCycles) override;
+
+    void onMemoryWrite(word_t addr) override;
+    void onMemoryDetached() override;
+
+private:
+    struct Operand {
+        const void* m_fetch = nullptr;
+        word_t m_word = 0;          // literal value or next word offset
+        byte_t m_register = 0;
+    };
+    struct Entry {
+        const void* m_handler = nullptr;  // nullptr when not predecoded
+        Operand m_a;
+        Operand m_b;
+        Instruction m_instruction;
+        cycles_t m_cycles = 0;
+        byte_t m_wordCount = 0;
+    };
+    struct Labels {
+        const void* const* m_opcodes;
+        const void* const* m_fetchA;
+        const void* const* m_fetchB;
+        const void* m_fallback;
+    };
+
+    long_t run(DCPU& cpu, Memory& mem, long_t maxInstructions, cycles_t maxCycles, Labels* outLabels);
+    void predecode(Memory& mem, word_t addr);
+    word_t skipConditionals(Memory& mem, word_t addr, cycles_t& outSkippedCount);
+    void clear();
+
+    vector<Entry> m_entries;
+    Labels m_labels;
+};
@@ -0,0 +1,104 @@
+#pragma once
+#include <dcpu-types.h>
+
+class DCPU;
+class Memory;
+
+enum EngineType {
+    EngineType_Switch,      // reference interpreter, DCPU::eval
+    EngineType_Threaded,
+    EngineType_Specialized,
+    EngineType_Block,
+    EngineType_Jit,
+
+    EngineType_Count,
+};
+
+inline const char* EngineTypeToStr(EngineType type) {
+    switch (type) {
+    case EngineType_Switch: return "switch";
+    case EngineType_Threaded: return "threaded";
+    case EngineType_Specialized: return "specialized";
+    case EngineType_Block: return "block";
+    case EngineType_Jit: return "jit";
+    default: return "[unknown]";
+    }
+}
+
+inline EngineType StrToEngineType(const string& str) {
+    for (int i=0; i<EngineType_Count; ++i) {
+        if (str == EngineTypeToStr(static_cast<EngineType>(i))) {
+            return static_cast<EngineType>(i);
+        }
+    }
+    return EngineType_Count;
+}
+
+// Operand addressing modes, as seen by the engines working on predecoded
+// instructions. Registers and literal values are carried aside.
+enum OperandKind {
+    OperandKind_Register,
+    OperandKind_Ref,
+    OperandKind_RefNext,
+    OperandKind_PushPop,
+    OperandKind_Peek,
+    OperandKind_Pick,
+    OperandKind_SP,
+    OperandKind_PC,
+    OperandKind_EX,
+    OperandKind_Next,
+    OperandKind_Literal,
+    OperandKind_None,
+
+    OperandKind_Count,
+};
+
+inline OperandKind GetOperandKind(Value v, bool isA, word_t nextWord, word_t& outWord, byte_t& outRegister) {
+    const word_t numV = static_cast<word_t>(v);
+    outWord = nextWord;
+    outRegister = numV & 0x7;
+    if (isA && numV >= 0x20) {
+        outWord = numV == 0x3F ? 0xFFFF : numV - 0x20;
+        return OperandKind_Literal;
+    }
+    if (v <= Value_Register_J)
+        return OperandKind_Register;
+    if (v <= Value_Register_Ref_J)
+        return OperandKind_Ref;
+    if (v <= Value_Register_RefNext_J)
+        return OperandKind_RefNext;
+    switch (v) {
+    case Value_PushPop: return OperandKind_PushPop;
+    case Value_Peek: return OperandKind_Peek;
+    case Value_Pick: return OperandKind_Pick;
+    case Value_SP: return OperandKind_SP;
+    case Value_PC: return OperandKind_PC;
+    case Value_EX: return OperandKind_EX;
+    case Value_Next: return OperandKind_Next;
+    case Value_NextLitteral: return OperandKind_Literal;
+    default: return OperandKind_None;
+    }
+}
+
+//
+// Alternative to the DCPU::eval switch interpreter. Engines must leave the
+// cpu and memory in the exact same state as the reference interpreter would,
+// cycle counts included.
+//
+class ExecutionEngine {
+public:
+    virtual ~ExecutionEngine() {};
+
+    // Executes at most maxInstructions instructions starting at the cpu pc,
+    // without updating devices nor delivering queued interrupts. Stops after
+    // the instruction that brings the cycles charged by this call to
+    // maxCycles or more (the next device event or the end of a budget), so the
+    // cpu sees it after the same instruction as with the switch interpreter.
+    // Returns early right after a special opcode, as those may touch devices
+    // or the interrupt queue, and once the pc reaches DCPU::getPCLimit().
+    // Returns the number of instructions executed.
+    virtual long_t execute(DCPU& cpu, Memory& mem, long_t maxInstructions, cycles_t maxCycles) = 0;
+
+    // Engines optimizing across instructions may be told not to, for debugging
+    virtual void setPeepholeEnabled(bool enabled) {}
+};
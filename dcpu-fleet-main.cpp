@@ -0,0 +1,143 @@
+#include <dcpu-fleet.h>
+#include <dcpu-batch.h>
+#include <dcpu-codex.h>
+#include <dcpu-hardware-clock.h>
+#include <dcpu-mapped-file.h>
+#include <dcpu-mem.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using std::vector;
+
+const char* StopReasonToStr(StopReason reason) {
+    switch (reason) {
+    case StopReason_PCLimit: return "done";
+    case StopReason_Budget: return "budget";
+    case StopReason_Interrupt: return "interrupt";
+    case StopReason_Breakpoint: return "breakpoint";
+    case StopReason_Predicate: return "predicate";
+    case StopReason_OnFire: return "on fire";
+    }
+    return "unknown";
+}
+
+// Sweeps one program over machines whose A register is their index
+int RunLockstep(const vector<word_t>& program, long_t machineCount, cycles_t budget, TimingMode timing,
+                bool printResults) {
+    LockstepBatch batch{program, machineCount, timing};
+    for (long_t i=0; i<machineCount; ++i) {
+        batch.getCPU(i).setRegister(Registers_A, static_cast<word_t>(i));
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const vector<StopReason> reasons = batch.run(budget);
+    const std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+
+    if (printResults) {
+        for (long_t i=0; i<machineCount; ++i) {
+            DCPU& cpu = batch.getCPU(i);
+            printf("#%u: %s, %u cycles, pc %04X sp %04X ex %04X, regs", i, StopReasonToStr(reasons[i]),
+                   cpu.getCycles(), cpu.getPC(), cpu.getSP(), cpu.getEX());
+            for (int r=0; r<Registers_Count; ++r) {
+                printf(" %04X", cpu.getRegister(static_cast<Registers>(r)));
+            }
+            printf("\n");
+        }
+    }
+
+    const BatchStats& stats = batch.getStats();
+    const uint64_t instructions = stats.m_lockstepInstructions + stats.m_scalarInstructions;
+    printf("machines: %u in lockstep groups of %u in %.3f s\n", machineCount, LockstepBatch::LaneCount,
+           seconds.count());
+    printf("instructions: %llu (%llu in lockstep, %zu machines diverged), %.1f MIPS\n",
+           static_cast<unsigned long long>(instructions),
+           static_cast<unsigned long long>(stats.m_lockstepInstructions), stats.m_divergedCount,
+           seconds.count() > 0 ? instructions / seconds.count() / 1e6 : 0);
+    return 0;
+}
+
+int main(int argc, char** args) {
+    FleetOptions options;
+    cycles_t budget = DCPU::NoCycleBudget;
+    long_t repeat = 1;
+    bool withClock = false;
+    bool printResults = false;
+    long_t lockstep = 0;
+    vector<const char*> filenames;
+    for (int i=1; i<argc; ++i) {
+        if (string{args[i]} == "--engine" && i+1 < argc) {
+            options.m_engine = StrToEngineType(args[++i]);
+        } else if (string{args[i]} == "--functional") {
+            options.m_timing = TimingMode_Functional;
+        } else if (string{args[i]} == "--threads" && i+1 < argc) {
+            options.m_threadCount = std::strtoul(args[++i], nullptr, 0);
+        } else if (string{args[i]} == "--budget" && i+1 < argc) {
+            budget = std::strtoul(args[++i], nullptr, 0);
+        } else if (string{args[i]} == "--repeat" && i+1 < argc) {
+            repeat = std::strtoul(args[++i], nullptr, 0);
+        } else if (string{args[i]} == "--clock") {
+            withClock = true;
+        } else if (string{args[i]} == "--results") {
+            printResults = true;
+        } else if (string{args[i]} == "--lockstep" && i+1 < argc) {
+            lockstep = std::strtoul(args[++i], nullptr, 0);
+        } else {
+            filenames.push_back(args[i]);
+        }
+    }
+    if (filenames.empty() || options.m_engine == EngineType_Count) {
+        printf("usage: dcpu-fleet [--engine name] [--functional] [--threads n] [--budget cycles] [--repeat n]\n"
+               "                  [--clock] [--results] [--lockstep n] <program-bin-file>...\n");
+        return 1;
+    }
+    if (withClock) {
+        options.m_setup = [](DCPU& cpu, Memory& mem) { cpu.addDevice<Clock>(); };
+    }
+
+    vector<vector<word_t>> programs;
+    for (const char* filename : filenames) {
+        const MappedFile binFile{filename};
+        if (!binFile.isOpen()) {
+            printf("failed to open file: %s\n", filename);
+            return 1;
+        }
+        vector<word_t>& program = programs.emplace_back(std::min<size_t>(binFile.size() / 2, Memory::LastValidAddress+1));
+        Codex::PackBytes(binFile.data(), program.size(), program.data());
+    }
+
+    if (lockstep > 0) {
+        return RunLockstep(programs.front(), lockstep, budget, options.m_timing, printResults);
+    }
+
+    vector<FleetJob> jobs(programs.size() * repeat);
+    for (size_t i=0; i<jobs.size(); ++i) {
+        jobs[i].m_program = programs[i % programs.size()];
+        jobs[i].m_cycleBudget = budget;
+    }
+
+    FleetRunner runner{options};
+    const vector<FleetResult> results = runner.run(jobs);
+
+    if (printResults) {
+        for (size_t i=0; i<results.size(); ++i) {
+            const FleetResult& result = results[i];
+            printf("%s #%zu: %s, %u cycles, pc %04X sp %04X ex %04X, regs", filenames[i % programs.size()],
+                   i / programs.size(), StopReasonToStr(result.m_stopReason), result.m_cycles,
+                   result.m_pc, result.m_sp, result.m_ex);
+            for (word_t value : result.m_registers) {
+                printf(" %04X", value);
+            }
+            printf("\n");
+        }
+    }
+
+    const FleetStats& stats = runner.getStats();
+    printf("jobs: %zu on %u threads in %.3f s (%.1f jobs/s)\n", stats.m_jobCount, stats.m_threadCount,
+           stats.m_seconds, stats.jobsPerSecond());
+    printf("instructions: %llu, %.1f MIPS per core\n", static_cast<unsigned long long>(stats.m_instructions),
+           stats.mipsPerCore());
+    printf("cycles: %llu, steals: %zu\n", static_cast<unsigned long long>(stats.m_cycles), stats.m_steals);
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include <dcpu-fleet.h>
+#include <dcpu-mem.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+    // jobs [m_begin, m_end) left to a worker, thieves take the upper half
+    struct alignas(64) WorkerQueue {
+        std::mutex m_mutex;
+        size_t m_begin = 0;
+        size_t m_end = 0;
+
+        bool pop(size_t& outIndex) {
+            std::lock_guard<std::mutex> lock{m_mutex};
+            if (m_begin == m_end)
+                return false;
+            outIndex = m_begin++;
+            return true;
+        }
+    };
+
+    struct WorkerTotals {
+        uint64_t m_instructions = 0;
+        uint64_t m_cycles = 0;
+        size_t m_steals = 0;
+    };
+
+    bool Steal(vector<WorkerQueue>& queues, size_t self) {
+        for (size_t i=1; i<queues.size(); ++i) {
+            WorkerQueue& victim = queues[(self + i) % queues.size()];
+            size_t begin = 0;
+            size_t end = 0;
+            {
+                std::lock_guard<std::mutex> lock{victim.m_mutex};
+                if (victim.m_begin == victim.m_end)
+                    continue;
+                begin = victim.m_begin + (victim.m_end - victim.m_begin) / 2;
+                end = victim.m_end;
+                victim.m_end = begin;
+            }
+            std::lock_guard<std::mutex> lock{queues[self].m_mutex};
+            queues[self].m_begin = begin;
+            queues[self].m_end = end;
+            return true;
+        }
+        return false;
+    }
+}
+
+FleetRunner::FleetRunner(const FleetOptions& options)
+    : m_options {options}
+{
+    if (m_options.m_threadCount == 0) {
+        m_options.m_threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+FleetResult FleetRunner::RunJob(const FleetJob& job, const FleetOptions& options, DCPU& cpu, Memory& mem) {
+    cpu.reset();
+    mem.Clear();
+    if (options.m_setup) {
+        options.m_setup(cpu, mem);
+    }
+    for (int i=0; i<Registers_Count; ++i) {
+        cpu.setRegister(static_cast<Registers>(i), job.m_registers[i]);
+    }
+    cpu.setPCLimit(mem.LoadProgram(job.m_program));
+
+    // interrupts only pause runFor, the budget covers the whole job
+    FleetResult result;
+    const cycles_t start = cpu.getCycles();
+    do {
+        const cycles_t elapsed = cpu.getCycles() - start;
+        const cycles_t remaining = job.m_cycleBudget == DCPU::NoCycleBudget
+            ? DCPU::NoCycleBudget
+            : job.m_cycleBudget - std::min(elapsed, job.m_cycleBudget);
+        result.m_stopReason = cpu.runFor(mem, remaining);
+    } while (result.m_stopReason == StopReason_Interrupt);
+
+    result.m_cycles = cpu.getCycles() - start;
+    result.m_instructions = cpu.getInstructionCount();
+    for (int i=0; i<Registers_Count; ++i) {
+        result.m_registers[i] = cpu.getRegister(static_cast<Registers>(i));
+    }
+    result.m_pc = cpu.getPC();
+    result.m_sp = cpu.getSP();
+    result.m_ex = cpu.getEX();
+    result.m_memory.resize(options.m_captureCount);
+    for (long_t i=0; i<options.m_captureCount; ++i) {
+        result.m_memory[i] = mem[static_cast<word_t>(options.m_captureAddr + i)];
+    }
+    return result;
+}
+
+vector<FleetResult> FleetRunner::run(const vector<FleetJob>& jobs) {
+    const size_t threadCount = std::min<size_t>(m_options.m_threadCount, std::max<size_t>(jobs.size(), 1));
+    vector<FleetResult> results(jobs.size());
+    vector<WorkerQueue> queues(threadCount);
+    vector<WorkerTotals> totals(threadCount);
+    for (size_t i=0; i<threadCount; ++i) {
+        queues[i].m_begin = jobs.size() * i / threadCount;
+        queues[i].m_end = jobs.size() * (i + 1) / threadCount;
+    }
+
+    auto work = [&](size_t self) {
+        // kept local, neighbouring totals share a cache line
+        WorkerTotals total;
+        // set up once, the caches and mappings are costly next to small jobs
+        std::unique_ptr<Memory> mem;
+        std::unique_ptr<DCPU> cpu;
+        while (true) {
+            size_t index = 0;
+            if (!queues[self].pop(index)) {
+                if (!Steal(queues, self))
+                    break; // no job is ever added, all left are running
+                ++total.m_steals;
+                continue;
+            }
+            if (cpu == nullptr) {
+                mem = std::make_unique<Memory>();
+                cpu = std::make_unique<DCPU>(m_options.m_timing);
+                cpu->setEngine(m_options.m_engine);
+            }
+            results[index] = RunJob(jobs[index], m_options, *cpu, *mem);
+            total.m_instructions += results[index].m_instructions;
+            total.m_cycles += results[index].m_cycles;
+        }
+        totals[self] = total;
+    };
+
+    const auto startTime = std::chrono::steady_clock::now();
+    vector<std::thread> workers;
+    for (size_t i=1; i<threadCount; ++i) {
+        workers.emplace_back(work, i);
+    }
+    work(0);
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - startTime;
+
+    m_stats = FleetStats{};
+    m_stats.m_jobCount = jobs.size();
+    m_stats.m_threadCount = threadCount;
+    m_stats.m_seconds = duration.count();
+    for (const WorkerTotals& total : totals) {
+        m_stats.m_instructions += total.m_instructions;
+        m_stats.m_cycles += total.m_cycles;
+        m_stats.m_steals += total.m_steals;
+    }
+    return results;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <dcpu.h>
+#include <dcpu-types.h>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+using std::vector;
+
+struct FleetJob {
+    vector<word_t> m_program;                   // loaded at address 0, runs until its end
+    cycles_t m_cycleBudget = DCPU::NoCycleBudget;
+    word_t m_registers[Registers_Count] = {};   // initial values
+};
+
+struct FleetResult {
+    StopReason m_stopReason = StopReason_PCLimit;
+    cycles_t m_cycles = 0;
+    uint64_t m_instructions = 0;
+    word_t m_registers[Registers_Count] = {};
+    word_t m_pc = 0;
+    word_t m_sp = 0;
+    word_t m_ex = 0;
+    vector<word_t> m_memory;                    // FleetOptions capture range
+};
+
+struct FleetOptions {
+    unsigned m_threadCount = 0;                 // 0 for one per hardware thread
+    EngineType m_engine = EngineType_Switch;
+    TimingMode m_timing = TimingMode_CycleAccurate;
+    word_t m_captureAddr = 0;
+    long_t m_captureCount = 0;                  // words copied into FleetResult::m_memory
+    std::function<void(DCPU&, Memory&)> m_setup; // adds devices, called before loading each job
+};
+
+struct FleetStats {
+    size_t m_jobCount = 0;
+    unsigned m_threadCount = 0;
+    double m_seconds = 0;
+    uint64_t m_instructions = 0;
+    uint64_t m_cycles = 0;
+    size_t m_steals = 0;
+
+    double jobsPerSecond() const { return m_seconds > 0 ? m_jobCount / m_seconds : 0; }
+    double mipsPerCore() const {
+        return m_seconds > 0 && m_threadCount > 0 ? m_instructions / m_seconds / 1e6 / m_threadCount : 0;
+    }
+};
+
+//
+// Runs many independent jobs over a pool of worker threads. Jobs are dealt out
+// evenly up front, each worker takes its own from the front and steals from
+// the back of another's once it runs dry. A worker runs its jobs one after the
+// other on a single DCPU and Memory, reset in between.
+//
+class FleetRunner {
+public:
+    explicit FleetRunner(const FleetOptions& options);
+
+    // results are in the order of the jobs
+    vector<FleetResult> run(const vector<FleetJob>& jobs);
+    const FleetStats& getStats() const { return m_stats; }
+
+    // resets cpu and mem then runs the job on them
+    static FleetResult RunJob(const FleetJob& job, const FleetOptions& options, DCPU& cpu, Memory& mem);
+
+private:
+    FleetOptions m_options;
+    FleetStats m_stats;
+};
@@ -0,0 +1,126 @@
+#include <dcpu-hardware-async.h>
+#include <dcpu-assert.h>
+#include <dcpu.h>
+#include <dcpu-mem.h>
+
+static_assert(Registers_Count == 8, "requests carry A to J");
+
+AsyncHardware::AsyncHardware(std::unique_ptr<DeviceWorker> worker, cycles_t latency)
+    : m_worker {std::move(worker)}
+    , m_latency {latency}
+{
+    dcpu_assert(m_latency > 0, "replies need at least a cycle of latency");
+    m_thread = std::thread{&AsyncHardware::work, this};
+}
+
+AsyncHardware::~AsyncHardware() {
+    m_isStopping.store(true);
+    {
+        std::lock_guard<std::mutex> lock{m_wakeMutex};
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+cycles_t AsyncHardware::interrupt(DCPU& cpu, Memory& mem) {
+    DeviceRequest request;
+    request.m_kind = DeviceRequestKind_Interrupt;
+    request.m_cycle = cpu.getCycles();
+    const cycles_t cycles = prepare(cpu, mem, request);
+    send(cpu, mem, std::move(request));
+    return cycles;
+}
+
+// Applies the replies due, waiting for the worker if it is late, then sends
+// the update request if that is due too. It is stamped with the cycle it was
+// asked for rather than the current one, which depends on the instruction
+// that went past it.
+cycles_t AsyncHardware::update(DCPU& cpu, Memory& mem) {
+    const cycles_t now = cpu.getCycles();
+    while (!m_replyCycles.empty() && static_cast<int32_t>(now - m_replyCycles.front()) >= 0) {
+        DeviceReply reply;
+        while (!m_replies.pop(reply)) {
+            std::this_thread::yield();
+        }
+        m_replyCycles.pop_front();
+        apply(cpu, mem, reply);
+    }
+
+    cycles_t cycles = 0;
+    if (m_nextUpdate != NoEvent && static_cast<int32_t>(now - m_nextUpdate) >= 0) {
+        DeviceRequest request;
+        request.m_kind = DeviceRequestKind_Update;
+        request.m_cycle = m_nextUpdate;
+        m_nextUpdate = NoEvent;
+        cycles = prepare(cpu, mem, request);
+        send(cpu, mem, std::move(request));
+    }
+    return cycles;
+}
+
+// the oldest reply in flight or the update, whichever comes first
+cycles_t AsyncHardware::nextEvent(const DCPU& cpu) const {
+    if (m_replyCycles.empty())
+        return m_nextUpdate;
+    if (m_nextUpdate == NoEvent)
+        return m_replyCycles.front();
+    const int32_t untilReply = static_cast<int32_t>(m_replyCycles.front() - cpu.getCycles());
+    const int32_t untilUpdate = static_cast<int32_t>(m_nextUpdate - cpu.getCycles());
+    return untilReply <= untilUpdate ? m_replyCycles.front() : m_nextUpdate;
+}
+
+void AsyncHardware::send(const DCPU& cpu, const Memory& mem, DeviceRequest&& request) {
+    dcpu_assert_fmt(m_replyCycles.size() < QueueCapacity, "more than %u requests in flight for device %d",
+                    QueueCapacity, m_deviceId);
+    for (word_t i=0; i<Registers_Count; ++i) {
+        request.m_registers[i] = cpu.getRegister(static_cast<Registers>(i));
+    }
+    m_replyCycles.push_back(request.m_cycle + m_latency);
+    while (!m_requests.push(std::move(request))) {
+        std::this_thread::yield();
+    }
+    // pairs with the fence in work, either the worker sees the request or we see it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_isSleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock{m_wakeMutex};
+        m_wake.notify_one();
+    }
+}
+
+void AsyncHardware::apply(DCPU& cpu, Memory& mem, const DeviceReply& reply) {
+    for (size_t i=0; i<reply.m_writes.size(); ++i) {
+        mem.Write(static_cast<word_t>(reply.m_writeAddr + i), reply.m_writes[i]);
+    }
+    for (word_t message : reply.m_interrupts) {
+        cpu.interrupt(message);
+    }
+    if (reply.m_isUpdateSet) {
+        m_nextUpdate = reply.m_nextUpdate;
+    }
+}
+
+// the worker thread, drains the requests left before stopping
+void AsyncHardware::work() {
+    DeviceRequest request;
+    while (true) {
+        if (!m_requests.pop(request)) {
+            std::unique_lock<std::mutex> lock{m_wakeMutex};
+            m_isSleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            m_wake.wait(lock, [this]() { return !m_requests.isEmpty() || m_isStopping.load(); });
+            m_isSleeping.store(false, std::memory_order_relaxed);
+            if (m_requests.isEmpty())
+                return;
+            continue;
+        }
+
+        DeviceReply reply;
+        reply.m_cycle = request.m_cycle + m_latency;
+        m_worker->process(request, reply);
+        while (!m_replies.push(std::move(reply))) {
+            if (m_isStopping.load())
+                return; // nobody takes the replies anymore
+            std::this_thread::yield();
+        }
+    }
+}
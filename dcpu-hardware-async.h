@@ -0,0 +1,87 @@
+#pragma once
+#include <dcpu-hardware.h>
+#include <dcpu-spsc-queue.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+enum DeviceRequestKind {
+    DeviceRequestKind_Interrupt,    // the guest sent HWI
+    DeviceRequestKind_Update,       // the update the device asked for is due
+};
+
+// What the cpu thread sends the worker, stamped with the cycle it was sent at
+struct DeviceRequest {
+    DeviceRequestKind m_kind = DeviceRequestKind_Interrupt;
+    cycles_t m_cycle = 0;
+    word_t m_registers[8] = {};     // A to J when the request was sent
+    vector<word_t> m_data;          // anything else AsyncHardware::prepare copies (guest memory, ...)
+};
+
+// What the worker answers, applied by the cpu thread at m_cycle
+struct DeviceReply {
+    cycles_t m_cycle = 0;           // the request's cycle plus the device latency
+    vector<word_t> m_interrupts;    // raised in that order
+    word_t m_writeAddr = 0;         // m_writes go to guest memory from there
+    vector<word_t> m_writes;
+    bool m_isUpdateSet = false;     // otherwise the next update stays as it was
+    cycles_t m_nextUpdate = Hardware::NoEvent;
+
+    void scheduleUpdate(cycles_t cycle) { m_isUpdateSet = true; m_nextUpdate = cycle; }
+};
+
+// The part of an AsyncHardware running on its own thread
+class DeviceWorker {
+public:
+    virtual ~DeviceWorker() {}
+    // gets the requests in the order they were sent
+    virtual void process(const DeviceRequest& request, DeviceReply& outReply) = 0;
+};
+
+//
+// Device doing its work on a host thread. HWI and the updates it schedules
+// become cycle stamped requests to its DeviceWorker, every reply is applied
+// latency cycles after its request whatever the time the worker took: the
+// cpu waits for a late worker and holds an early reply until its cycle, so
+// the guest sees the same thing on every run. Requests and replies go through
+// single producer single consumer queues, the worker only sleeps when it has
+// nothing to do. The worker's state is not part of snapshots.
+//
+class AsyncHardware : public Hardware {
+public:
+    static constexpr uint32_t QueueCapacity = 64;    // requests in flight at most
+
+    AsyncHardware(std::unique_ptr<DeviceWorker> worker, cycles_t latency);
+    ~AsyncHardware() override;
+
+    cycles_t update(DCPU& cpu, Memory& mem) override;
+    cycles_t interrupt(DCPU& cpu, Memory& mem) override;
+    cycles_t nextEvent(const DCPU& cpu) const override;
+
+protected:
+    // Called on the cpu thread before a request is sent, to copy what the
+    // worker needs besides the registers. Returns the cycles it takes.
+    virtual cycles_t prepare(const DCPU& cpu, const Memory& mem, DeviceRequest& request) { return 0; }
+    DeviceWorker& getWorker() { return *m_worker; }
+
+private:
+    void send(const DCPU& cpu, const Memory& mem, DeviceRequest&& request);
+    void apply(DCPU& cpu, Memory& mem, const DeviceReply& reply);
+    void work();
+
+    std::unique_ptr<DeviceWorker> m_worker;
+    cycles_t m_latency;
+    std::deque<cycles_t> m_replyCycles;     // cycles of the replies in flight, oldest first
+    cycles_t m_nextUpdate = NoEvent;
+
+    SpscQueue<DeviceRequest, QueueCapacity> m_requests;
+    SpscQueue<DeviceReply, QueueCapacity> m_replies;
+    std::mutex m_wakeMutex;                 // the worker sleeps on m_wake when there is no request
+    std::condition_variable m_wake;
+    std::atomic<bool> m_isSleeping {false};
+    std::atomic<bool> m_isStopping {false};
+    std::thread m_thread;
+};
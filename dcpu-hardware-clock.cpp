@@ -2,6 +2,7 @@
 #include <dcpu-assert.h>
 #include <dcpu.h>
 #include <cstdio>
+#include <thread>
 
 Clock::Clock()
     : m_period{0}
@@ -17,6 +18,14 @@ cycles_t Clock::update(DCPU& cpu, Memory& mem) {
     if (m_period == 0)
         return 0;
 
+    if (m_timeMode == ClockTime_Virtual) {
+        // only scheduled while interrupts are enabled, the count is derived
+        if (m_interruptsEnabled) {
+            cpu.interrupt(m_deviceId);
+        }
+        return 0;
+    }
+
     using secduration = std::chrono::duration<float>;
     const time now = std::chrono::system_clock::now();
     const secduration duration = (now - m_startTime);
@@ -30,7 +39,58 @@ cycles_t Clock::update(DCPU& cpu, Memory& mem) {
         }
     }
 
-    return 1;
+    return 0;
+}
+
+// Virtual ticks happen every period / 60 seconds of cpu time, tick n at the
+// first cycle reaching n * period * CyclesPerSecond / 60 since the period
+// was set. The wall clock tick is estimated in cycles at the nominal speed,
+// the host can be much faster so the wall clock is polled in between.
+cycles_t Clock::nextEvent(const DCPU& cpu) const {
+    if (m_period == 0)
+        return NoEvent;
+
+    if (m_timeMode == ClockTime_Virtual) {
+        if (!m_interruptsEnabled)
+            return NoEvent;
+        const uint64_t tickCycles = (uint64_t{ticksSinceStart(cpu)} + 1) * m_period * DCPU::CyclesPerSecond;
+        return m_startCycle + static_cast<cycles_t>((tickCycles + 59) / 60);
+    }
+
+    using secduration = std::chrono::duration<float>;
+    const secduration duration = (std::chrono::system_clock::now() - m_startTime);
+    const float remaining = (m_period / 60.0f - duration.count()) * DCPU::CyclesPerSecond;
+    return cpu.getCycles() + static_cast<cycles_t>(std::clamp(remaining, 1.0f, float{PollCycles}));
+}
+
+long_t Clock::ticksSinceStart(const DCPU& cpu) const {
+    const uint64_t elapsed = cpu.getCycles() - m_startCycle;
+    return static_cast<long_t>(elapsed * 60 / (uint64_t{m_period} * DCPU::CyclesPerSecond));
+}
+
+void Clock::saveState(vector<uint32_t>& outState) const {
+    outState.insert(outState.end(), {m_timeMode, m_period, m_tickCount, m_startCycle, m_interruptsEnabled});
+}
+
+bool Clock::checkState(const vector<uint32_t>& state) const {
+    return state.size() == 5 && state[0] <= ClockTime_Wall;
+}
+
+// the wall clock restarts its current tick from the load
+void Clock::loadState(const DCPU& cpu, const vector<uint32_t>& state) {
+    m_timeMode = static_cast<ClockTime>(state[0]);
+    m_period = static_cast<word_t>(state[1]);
+    m_tickCount = static_cast<word_t>(state[2]);
+    m_startCycle = state[3];
+    m_interruptsEnabled = state[4] != 0;
+    m_startTime = std::chrono::system_clock::now();
+}
+
+// wall clock ticks need the skipped cycles to pass for real
+void Clock::onIdle(cycles_t cycles) {
+    if (m_timeMode == ClockTime_Wall) {
+        std::this_thread::sleep_for(std::chrono::microseconds(uint64_t{cycles} * 1000000 / DCPU::CyclesPerSecond));
+    }
 }
 
 cycles_t Clock::interrupt(DCPU& cpu, Memory& mem) {
@@ -39,13 +99,16 @@ cycles_t Clock::interrupt(DCPU& cpu, Memory& mem) {
     switch (a) {
     case 0: {
         m_period = b;
+        m_tickCount = 0;
         if (m_period != 0) {
             m_startTime = std::chrono::system_clock::now();
+            m_startCycle = cpu.getCycles();
         } 
         break;
     }
     case 1: {
-        cpu.setRegister(Registers_C, m_tickCount);
+        const bool isVirtual = m_timeMode == ClockTime_Virtual && m_period != 0;
+        cpu.setRegister(Registers_C, isVirtual ? static_cast<word_t>(ticksSinceStart(cpu)) : m_tickCount);
         break;
     }
     case 2: {
@@ -4,14 +4,28 @@
 
 class Clock : public Hardware {
 public:
+    static constexpr cycles_t PollCycles = 1000;   // the wall clock is read at most this far apart
+
     Clock();
     cycles_t update(DCPU& cpu, Memory& mem) override;
     cycles_t interrupt(DCPU& cpu, Memory& mem) override;
+    cycles_t nextEvent(const DCPU& cpu) const override;
+    void saveState(vector<uint32_t>& outState) const override;
+    bool checkState(const vector<uint32_t>& state) const override;
+    void loadState(const DCPU& cpu, const vector<uint32_t>& state) override;
+    void onIdle(cycles_t cycles) override;
+
+    void setTimeMode(ClockTime mode) { m_timeMode = mode; }
+    ClockTime getTimeMode() const { return m_timeMode; }
 
 private:
     using time = std::chrono::time_point<std::chrono::system_clock>;
+    long_t ticksSinceStart(const DCPU& cpu) const;
+
+    ClockTime m_timeMode = ClockTime_Virtual;
     word_t m_period = 0;
     word_t m_tickCount = 0;
     time m_startTime;
+    cycles_t m_startCycle = 0;
     bool m_interruptsEnabled = false;
 };
@@ -0,0 +1,187 @@
+#include <dcpu-hardware-monitor-headless.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+namespace {
+    // frame patterns have a single %d conversion, with an optional width of
+    // up to two digits, zero padded when it starts with 0
+    bool IsFramePattern(const string& pattern, bool& outHasConversion, size_t& outPercent, size_t& outEnd) {
+        outPercent = pattern.find('%');
+        outHasConversion = outPercent != string::npos;
+        if (!outHasConversion)
+            return true;
+        outEnd = pattern.find_first_not_of("0123456789", outPercent + 1);
+        return outEnd != string::npos && outEnd - outPercent <= 3 && pattern[outEnd] == 'd'
+            && pattern.find('%', outEnd) == string::npos;
+    }
+
+    uint32_t Crc32(const byte_t* bytes, size_t count, uint32_t crc = 0) {
+        static const struct Table {
+            uint32_t m_entries[256];
+            Table() {
+                for (uint32_t i=0; i<256; ++i) {
+                    uint32_t c = i;
+                    for (int k=0; k<8; ++k) {
+                        c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                    }
+                    m_entries[i] = c;
+                }
+            }
+        } table;
+        crc = ~crc;
+        for (size_t i=0; i<count; ++i) {
+            crc = table.m_entries[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    void PushBigEndian(vector<byte_t>& out, uint32_t value) {
+        out.insert(out.end(), {static_cast<byte_t>(value >> 24), static_cast<byte_t>(value >> 16),
+                               static_cast<byte_t>(value >> 8), static_cast<byte_t>(value)});
+    }
+
+    // chunk length, type, data and crc of type and data
+    void PushChunk(vector<byte_t>& out, const char* type, const byte_t* data, uint32_t count) {
+        PushBigEndian(out, count);
+        const size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data, data + count);
+        PushBigEndian(out, Crc32(out.data() + start, count + 4));
+    }
+}
+
+HeadlessDisplay::HeadlessDisplay(const string& pattern, CaptureFormat format)
+    : m_pattern {pattern}
+    , m_format {format}
+{
+    bool hasConversion = false;
+    size_t percent = 0;
+    size_t end = 0;
+    m_isCapturing = IsFramePattern(pattern, hasConversion, percent, end);
+    m_isAppending = !hasConversion;
+    if (!m_isCapturing) {
+        printf("capture pattern needs a single %%d conversion: %s\n", pattern.c_str());
+    } else if (hasConversion) {
+        // the frame number is put in by hand, the pattern is never a printf format
+        m_prefix = pattern.substr(0, percent);
+        m_suffix = pattern.substr(end + 1);
+        m_padding = pattern[percent + 1] == '0' ? '0' : ' ';
+        m_width = end > percent + 1 ? std::stoul(pattern.substr(percent + 1, end - percent - 1)) : 0;
+    }
+}
+
+HeadlessDisplay::~HeadlessDisplay() {
+    close();
+}
+
+void HeadlessDisplay::close() {
+    if (m_file != nullptr) {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+void HeadlessDisplay::present(const word_t* pixels, bool isChanged) {
+    if (isChanged) {
+        // RGBA4444 to RGBA8888, each nibble repeated
+        for (long_t i=0; i<Monitor::Width * Monitor::Height; ++i) {
+            const word_t pixel = pixels[i];
+            byte_t* rgba = m_framebuffer + i*4;
+            rgba[0] = 0x11 * (pixel >> 12);
+            rgba[1] = 0x11 * ((pixel >> 8) & 0xF);
+            rgba[2] = 0x11 * ((pixel >> 4) & 0xF);
+            rgba[3] = 0x11 * (pixel & 0xF);
+        }
+        if (m_isCapturing) {
+            encode();
+        }
+    }
+    if (m_isCapturing && !write()) {
+        m_isCapturing = false;
+    }
+    ++m_frameCount;
+}
+
+void HeadlessDisplay::encode() {
+    m_encoded.clear();
+    switch (m_format) {
+    case CaptureFormat_Raw:
+        m_encoded.assign(m_framebuffer, m_framebuffer + FramebufferBytes);
+        break;
+    case CaptureFormat_PPM: {
+        char header[32];
+        const int length = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", Monitor::Width, Monitor::Height);
+        m_encoded.assign(header, header + length);
+        for (long_t i=0; i<FramebufferBytes; i+=4) {
+            m_encoded.insert(m_encoded.end(), m_framebuffer + i, m_framebuffer + i + 3);
+        }
+        break;
+    }
+    case CaptureFormat_PNG: {
+        static const byte_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        m_encoded.assign(signature, signature + 8);
+        vector<byte_t> header;
+        PushBigEndian(header, Monitor::Width);
+        PushBigEndian(header, Monitor::Height);
+        header.insert(header.end(), {8, 6, 0, 0, 0});     // 8 bit RGBA, no interlace
+        PushChunk(m_encoded, "IHDR", header.data(), header.size());
+
+        // a zlib stream of a single stored block, rows start with filter 0
+        constexpr long_t RowBytes = Monitor::Width * 4;
+        constexpr uint32_t DataBytes = (RowBytes + 1) * Monitor::Height;
+        static_assert(DataBytes <= 0xFFFF, "one stored deflate block holds the image");
+        vector<byte_t> stream = {0x78, 0x01, 0x01,
+                                 static_cast<byte_t>(DataBytes), static_cast<byte_t>(DataBytes >> 8),
+                                 static_cast<byte_t>(~DataBytes), static_cast<byte_t>(~DataBytes >> 8)};
+        uint32_t a = 1;
+        uint32_t b = 0;
+        for (long_t y=0; y<Monitor::Height; ++y) {
+            stream.push_back(0);
+            stream.insert(stream.end(), m_framebuffer + y*RowBytes, m_framebuffer + (y+1)*RowBytes);
+        }
+        // adler32, 5552 bytes is the most summed before b can overflow
+        for (size_t start=7; start<stream.size(); start+=5552) {
+            const size_t end = std::min<size_t>(start + 5552, stream.size());
+            for (size_t i=start; i<end; ++i) {
+                a += stream[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        PushBigEndian(stream, (b << 16) | a);
+        PushChunk(m_encoded, "IDAT", stream.data(), stream.size());
+        PushChunk(m_encoded, "IEND", nullptr, 0);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+bool HeadlessDisplay::write() {
+    if (m_isAppending) {
+        if (m_file == nullptr) {
+            m_file = fopen(m_pattern.c_str(), "wb");
+        }
+        if (m_file == nullptr || fwrite(m_encoded.data(), 1, m_encoded.size(), m_file) != m_encoded.size()) {
+            printf("failed to write frame %u to: %s\n", m_frameCount, m_pattern.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    string number = std::to_string(m_frameCount);
+    if (number.size() < m_width) {
+        number.insert(0, m_width - number.size(), m_padding);
+    }
+    const string path = m_prefix + number + m_suffix;
+    FILE* file = fopen(path.c_str(), "wb");
+    bool isWritten = file != nullptr && fwrite(m_encoded.data(), 1, m_encoded.size(), file) == m_encoded.size();
+    isWritten = file != nullptr && fclose(file) == 0 && isWritten;
+    if (!isWritten) {
+        printf("failed to write frame %u to: %s\n", m_frameCount, path.c_str());
+    }
+    return isWritten;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <dcpu-hardware-monitor.h>
+#include <cstdio>
+
+enum CaptureFormat {
+    CaptureFormat_Raw,      // the framebuffer bytes as is
+    CaptureFormat_PPM,      // binary portable pixmap (P6), alpha dropped
+    CaptureFormat_PNG,      // RGBA, deflate stored blocks so no zlib is needed
+
+    CaptureFormat_Count,
+};
+
+inline const char* CaptureFormatToStr(CaptureFormat format) {
+    switch (format) {
+    case CaptureFormat_Raw: return "raw";
+    case CaptureFormat_PPM: return "ppm";
+    case CaptureFormat_PNG: return "png";
+    default: return "[unknown]";
+    }
+}
+
+inline CaptureFormat StrToCaptureFormat(const string& str) {
+    for (int i=0; i<CaptureFormat_Count; ++i) {
+        if (str == CaptureFormatToStr(static_cast<CaptureFormat>(i))) {
+            return static_cast<CaptureFormat>(i);
+        }
+    }
+    return CaptureFormat_Count;
+}
+
+//
+// Monitor frames drawn into an in-memory RGBA framebuffer, on the cpu thread
+// so none is dropped. Frames can also be written out, each one to the pattern
+// formatted with the frame number ("frame-%05d.ppm") or all of them one after
+// the other when the pattern has no conversion. An unchanged frame is written
+// again from the bytes encoded for the previous one.
+//
+class HeadlessDisplay : public MonitorDisplay {
+public:
+    static constexpr long_t FramebufferBytes = Monitor::Width * Monitor::Height * 4;
+
+    HeadlessDisplay() {}
+    HeadlessDisplay(const string& pattern, CaptureFormat format);
+    HeadlessDisplay(const HeadlessDisplay&) = delete;
+    HeadlessDisplay& operator=(const HeadlessDisplay&) = delete;
+    ~HeadlessDisplay() override;
+
+    void close() override;
+    void present(const word_t* pixels, bool isChanged) override;
+    bool needsEveryFrame() const override { return true; }
+
+    // RGBA bytes of the last frame, row after row
+    const byte_t* getFramebuffer() const { return m_framebuffer; }
+    long_t getFrameCount() const { return m_frameCount; }
+    // false once a frame could not be written, capture stops there
+    bool isCapturing() const { return m_isCapturing; }
+
+private:
+    void encode();
+    bool write();
+
+    string m_pattern;
+    string m_prefix;                    // the pattern around its conversion
+    string m_suffix;
+    size_t m_width = 0;                 // the frame number padded to it
+    char m_padding = ' ';
+    CaptureFormat m_format = CaptureFormat_Raw;
+    bool m_isCapturing = false;
+    bool m_isAppending = false;
+    FILE* m_file = nullptr;             // the file frames are appended to
+    vector<byte_t> m_encoded;           // the last frame in m_format
+    byte_t m_framebuffer[FramebufferBytes] = {};
+    long_t m_frameCount = 0;
+};
@@ -0,0 +1,57 @@
+#include <dcpu-hardware-monitor-sdl.h>
+#include <SDL.h>
+#include <cstdio>
+
+void SdlDisplay::open() {
+    if( SDL_Init( SDL_INIT_VIDEO ) < 0 ) {
+        printf( "SDL could not initialize! SDL_Error: %s\n", SDL_GetError() );
+    } else {
+        m_window = SDL_CreateWindow( "LEM1802 - Low Energy Monitor",
+                                     SDL_WINDOWPOS_UNDEFINED,
+                                     SDL_WINDOWPOS_UNDEFINED,
+                                     Monitor::Width * PixelZoom,
+                                     Monitor::Height * PixelZoom,
+                                     SDL_WINDOW_SHOWN );
+        if( m_window == nullptr ) {
+            printf( "Window could not be created! SDL_Error: %s\n", SDL_GetError() );
+        } else {
+            m_renderer = SDL_CreateRenderer( m_window, -1, SDL_RENDERER_ACCELERATED );
+            if( m_renderer == nullptr ) {
+                printf( "Renderer could not be created! SDL Error: %s\n", SDL_GetError() );
+            } else {
+                SDL_SetRenderDrawColor( m_renderer, 0xFF, 0xFF, 0xFF, 0xFF );
+
+                m_screenTexture = SDL_CreateTexture(m_renderer, SDL_PIXELFORMAT_RGBA4444, SDL_TEXTUREACCESS_STREAMING,
+                                                    Monitor::Width, Monitor::Height);
+                if (m_screenTexture == nullptr) {
+                    printf( "texture could not be created! SDL_Error: %s\n", SDL_GetError() );
+                } 
+            }
+        }
+    }
+}
+
+void SdlDisplay::close() {
+    SDL_DestroyTexture( m_screenTexture );
+    SDL_DestroyRenderer( m_renderer );
+    SDL_DestroyWindow( m_window );
+    SDL_Quit();        
+    m_screenTexture = nullptr;
+    m_renderer = nullptr;
+    m_window = nullptr;
+}
+
+// a locked streaming texture does not keep its content, the whole screen is uploaded
+void SdlDisplay::present(const word_t* pixels, bool isChanged) {
+    if (!isChanged || m_renderer == nullptr || m_screenTexture == nullptr)
+        return;
+
+    if (SDL_UpdateTexture(m_screenTexture, nullptr, pixels, Monitor::Width * sizeof(word_t)) != 0) {
+        printf( "texture could not be updated... SDL_Error: %s\n", SDL_GetError() );
+        return;
+    }
+
+    SDL_RenderClear( m_renderer );
+    SDL_RenderCopy( m_renderer, m_screenTexture, nullptr, nullptr );
+    SDL_RenderPresent( m_renderer );
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <dcpu-hardware-monitor.h>
+
+class SDL_Renderer;
+class SDL_Texture;
+class SDL_Window;
+
+// Monitor frames shown in an SDL window
+class SdlDisplay : public MonitorDisplay {
+public:
+    static constexpr word_t PixelZoom = 4;
+
+    void open() override;
+    void close() override;
+    void present(const word_t* pixels, bool isChanged) override;
+
+private:
+    SDL_Window* m_window = nullptr;
+    SDL_Renderer* m_renderer = nullptr;
+    SDL_Texture* m_screenTexture = nullptr;
+};
@@ -2,8 +2,8 @@
 #include <dcpu-assert.h>
 #include <dcpu.h>
 #include <dcpu-mem.h>
-#include <SDL.h>
 #include <cstdio>
+#include <cstring>
 // #include <random>
 #include <algorithm>
 
@@ -50,41 +50,63 @@ Monitor::Monitor()
     m_manifacturer = 0x1c6c8b36;    // NYA_ELEKTRISKA
 
     initializeDefaults();
+    std::copy(default_font, default_font + FontWords, m_font);
+    std::copy(m_defaultPalette, m_defaultPalette + PaletteWords, m_palette);
+    buildGlyphs(m_font);
+    buildColors(m_palette);
     m_blinkTime = std::chrono::system_clock::now();
+    m_frameTime = m_blinkTime;
+}
+
+Monitor::~Monitor() {
+    stopRendering();
+}
 
-    if( SDL_Init( SDL_INIT_VIDEO ) < 0 ) {
-        printf( "SDL could not initialize! SDL_Error: %s\n", SDL_GetError() );
+void Monitor::setDisplay(std::unique_ptr<MonitorDisplay> display) {
+    stopRendering();
+    m_display = std::move(display);
+    m_hasDrawnFrame = false;
+    if (m_display == nullptr)
+        return;
+
+    if (m_display->needsEveryFrame()) {
+        m_display->open();
     } else {
-        m_window = SDL_CreateWindow( "LEM1802 - Low Energy Monitor",
-                                     SDL_WINDOWPOS_UNDEFINED,
-                                     SDL_WINDOWPOS_UNDEFINED,
-                                     Width * PixelZoom,
-                                     Height * PixelZoom,
-                                     SDL_WINDOW_SHOWN );
-        if( m_window == nullptr ) {
-            printf( "Window could not be created! SDL_Error: %s\n", SDL_GetError() );
-        } else {
-            m_renderer = SDL_CreateRenderer( m_window, -1, SDL_RENDERER_ACCELERATED );
-            if( m_renderer == nullptr ) {
-                printf( "Renderer could not be created! SDL Error: %s\n", SDL_GetError() );
-            } else {
-                SDL_SetRenderDrawColor( m_renderer, 0xFF, 0xFF, 0xFF, 0xFF );
-
-                m_screenTexture = SDL_CreateTexture(m_renderer, SDL_PIXELFORMAT_RGBA4444, SDL_TEXTUREACCESS_STREAMING,
-                                                    Width, Height);
-                if (m_screenTexture == nullptr) {
-                    printf( "texture could not be created! SDL_Error: %s\n", SDL_GetError() );
-                } 
-            }
+        m_isQuitting = false;
+        m_hasPendingFrame = false;
+        m_renderThread = std::thread{&Monitor::renderLoop, this};
+    }
+}
+
+void Monitor::stopRendering() {
+    if (m_renderThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock{m_frameMutex};
+            m_isQuitting = true;
         }
+        m_frameCondition.notify_one();
+        m_renderThread.join();
+    } else if (m_display != nullptr) {
+        m_display->close();
     }
 }
 
-Monitor::~Monitor() {
-    SDL_DestroyTexture( m_screenTexture );
-    SDL_DestroyRenderer( m_renderer );
-    SDL_DestroyWindow( m_window );
-    SDL_Quit();        
+// the display is opened, used and closed on this thread only
+void Monitor::renderLoop() {
+    m_display->open();
+    Frame frame;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock{m_frameMutex};
+            m_frameCondition.wait(lock, [this]() { return m_hasPendingFrame || m_isQuitting; });
+            if (m_isQuitting)
+                break;
+            frame = m_pendingFrame;
+            m_hasPendingFrame = false;
+        }
+        render(frame);
+    }
+    m_display->close();
 }
 
 #define defcolor(r,g,b) ((0xF & r) << 8 | (0xF & g) << 4 | (0xF & b))
@@ -108,82 +130,183 @@ void Monitor::initializeDefaults(){
     m_defaultPalette[15]    = defcolor(0x7, 0x0, 0x7);
 }
 
-void Monitor::displayChr(word_t data, word_t i, word_t* pixels){
+// A font character is two words, the high byte of the first one is the
+// leftmost column and bit n of a column the pixel of row n.
+void Monitor::buildGlyphs(const word_t* font) {
+    for (word_t chr=0; chr<128; ++chr) {
+        const byte_t columns[CharWidth] = {static_cast<byte_t>(font[chr*2] >> 8),
+                                           static_cast<byte_t>(font[chr*2]),
+                                           static_cast<byte_t>(font[chr*2+1] >> 8),
+                                           static_cast<byte_t>(font[chr*2+1])};
+        for (word_t dy=0; dy<CharHeight; ++dy) {
+            uint64_t row = 0;
+            for (word_t dx=0; dx<CharWidth; ++dx) {
+                if ((columns[dx] >> dy) & 1) {
+                    row |= uint64_t{0xFFFF} << (16*dx);
+                }
+            }
+            m_glyphRows[chr][dy] = row;
+        }
+    }
+}
+
+void Monitor::buildColors(const word_t* palette) {
+    for (word_t i=0; i<PaletteWords; ++i) {
+        const word_t color = ((palette[i] & 0xFFF) << 4) | 0xF;
+        m_colorRows[i] = uint64_t{color} * 0x0001000100010001;
+    }
+}
+
+// Blends whole glyph rows, the fixed size loop gets vectorized at -O2
+void Monitor::displayChr(word_t data, word_t i, bool blinkSwap){
     word_t fg = data >> 12;
     word_t bg = data == 0 ? 1 : 0xF & (data >> 8); // default pal[1] when no data
     const word_t blink = 0x1 & (data >> 7);
-    if (blink != 0 && m_blinkSwap) {
+    if (blink != 0 && blinkSwap) {
         std::swap(fg, bg);
     }
-    const word_t chr = 0x7F & data;
-    const word_t fgcolor = (m_defaultPalette[fg] << 4) | 0xF;
-    const word_t bgcolor = (m_defaultPalette[bg] << 4) | 0xF;
-    const word_t word0 = default_font[chr*2];
-    const word_t word1 = default_font[chr*2+1];
-    const byte_t bytes[4] = {static_cast<byte_t>(word0 >> 8),
-                             static_cast<byte_t>(word0),
-                             static_cast<byte_t>(word1 >> 8),
-                             static_cast<byte_t>(word1)};
-
-    for (int dy=0; dy<8; ++dy) {
-        for (int dx=0; dx<4; ++dx) {
-            const word_t x = CharWidth * (i % RowWidth) + dx;
-            const word_t y = CharHeight * (i / RowWidth) + dy;
-
-            const bool isForeground = data == 0 ? false : (0x1 & bytes[dx] >> dy); // bgcolor default when no data
-            const word_t color = isForeground ? fgcolor : bgcolor;
-            pixels[x + y*Width] = color;
-        }
+    if (data == 0) {
+        fg = bg; // bgcolor default when no data
+    }
+    const uint64_t* glyph = m_glyphRows[0x7F & data];
+    const uint64_t fgRow = m_colorRows[fg];
+    const uint64_t bgRow = m_colorRows[bg];
+    uint64_t rows[CharHeight];
+    for (word_t dy=0; dy<CharHeight; ++dy) {
+        rows[dy] = (fgRow & glyph[dy]) | (bgRow & ~glyph[dy]);
+    }
+
+    word_t* pixels = m_pixels + (i / RowWidth) * CharHeight * Width + (i % RowWidth) * CharWidth;
+    for (word_t dy=0; dy<CharHeight; ++dy) {
+        std::memcpy(pixels + dy*Width, &rows[dy], sizeof(rows[dy]));
     }
 }
 
+// A frame every 1/60 s of cpu time while the screen is mapped, in wall time
+// the host clock is polled in between as for the clock device.
+cycles_t Monitor::nextEvent(const DCPU& cpu) const {
+    if (m_memMapAddr == 0)
+        return NoEvent;
+    return cpu.getCycles() + (m_timeMode == ClockTime_Virtual ? DCPU::CyclesPerSecond / FramesPerSecond : PollCycles);
+}
+
+void Monitor::saveState(vector<uint32_t>& outState) const {
+    outState.insert(outState.end(), {m_memMapAddr, m_memFontAddr, m_memPaletteAddr, m_borderColor});
+}
+
+bool Monitor::checkState(const vector<uint32_t>& state) const {
+    return state.size() == 4;
+}
+
+void Monitor::loadState(const DCPU& cpu, const vector<uint32_t>& state) {
+    m_memMapAddr = static_cast<word_t>(state[0]);
+    m_memFontAddr = static_cast<word_t>(state[1]);
+    m_memPaletteAddr = static_cast<word_t>(state[2]);
+    m_borderColor = static_cast<word_t>(state[3]);
+}
+
 cycles_t Monitor::update(DCPU& cpu, Memory& mem) {
     if (m_memMapAddr == 0)
         return 0;
 
-    if (m_renderer == nullptr || m_screenTexture == nullptr)
+    if (m_timeMode == ClockTime_Virtual) {
+        // blinking follows the cpu time too, frames are reproducible
+        const cycles_t blinkCycles = static_cast<cycles_t>(DCPU::CyclesPerSecond * BlinkDelay);
+        m_blinkSwap = (cpu.getCycles() / blinkCycles) & 1;
+        publishFrame(cpu, mem);
         return 0;
+    }
 
     using secduration = std::chrono::duration<float>;
     const time now = std::chrono::system_clock::now();
-    const secduration duration = (now - m_blinkTime);
-    const float dt = duration.count();
-    if (dt > BlinkDelay) {
+    if (secduration{now - m_frameTime}.count() < 1.0f / FramesPerSecond)
+        return 0;
+    m_frameTime = now;
+    if (secduration{now - m_blinkTime}.count() > BlinkDelay) {
         m_blinkTime = now;
         m_blinkSwap = !m_blinkSwap;
     }
+    publishFrame(cpu, mem);
+    return 0;
+}
 
-    word_t* pixels = nullptr;
-    int pitch = 0;
-    if (SDL_LockTexture(m_screenTexture, nullptr, (void**)&pixels, &pitch) != 0) {
-        printf( "texture could not be locked... SDL_Error: %s\n", SDL_GetError() );
-        return 0;
+// only copies under the lock, never waits for the renderer
+void Monitor::publishFrame(const DCPU& cpu, const Memory& mem) {
+    if (m_display == nullptr)
+        return;
+
+    refreshMapped(mem, m_memFontAddr, default_font, FontWords, m_font, m_fontVersion);
+    refreshMapped(mem, m_memPaletteAddr, m_defaultPalette, PaletteWords, m_palette, m_paletteVersion);
+    if (!m_renderThread.joinable()) {
+        Frame frame;
+        copyFrame(mem, frame);
+        render(frame);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock{m_frameMutex};
+        copyFrame(mem, m_pendingFrame);
+        m_hasPendingFrame = true;
     }
+    m_frameCondition.notify_one();
+}
 
-    const word_t max = std::min(386, Memory::LastValidAddress+1 - m_memMapAddr);
-    for (word_t i=0; i<max; ++i) {
-        const word_t data = mem[m_memMapAddr + i];
-        displayChr(data, i, pixels);
+// A font or palette mapped at 0 is the default one. The words are compared
+// with the previous frame's so a changed font or palette is seen however it
+// was written.
+void Monitor::refreshMapped(const Memory& mem, word_t addr, const word_t* defaults, word_t count,
+                            word_t* cache, long_t& version) {
+    bool isChanged = false;
+    for (word_t i=0; i<count; ++i) {
+        const word_t value = addr == 0 ? defaults[i] : mem[static_cast<word_t>(addr + i)];
+        isChanged |= value != cache[i];
+        cache[i] = value;
     }
+    if (isChanged) {
+        ++version;
+    }
+}
 
-    SDL_UnlockTexture(m_screenTexture);
-    
-    // std::random_device rd;
-    // std::mt19937 gen(rd());
-    // std::uniform_int_distribution<> distrib(0, 255);
-        
-    // SDL_LockTexture(m_screenTexture, nullptr, (void**)&pixels, &pitch);
-        
-    // for (uint32_t i=0; i<Width*Height; ++i) {
-    //     pixels[i] = distrib(gen) << 12 | distrib(gen) << 8 | distrib(gen) << 4 | distrib(gen);
-    // }
-
-    // SDL_UnlockTexture(m_screenTexture);
-        
-    SDL_RenderClear( m_renderer );
-    SDL_RenderCopy( m_renderer, m_screenTexture, nullptr, nullptr );
-    SDL_RenderPresent( m_renderer );
-    return 1;
+void Monitor::copyFrame(const Memory& mem, Frame& outFrame) const {
+    const word_t count = static_cast<word_t>(std::min<long_t>(CellCount, Memory::LastValidAddress+1 - m_memMapAddr));
+    for (word_t i=0; i<count; ++i) {
+        outFrame.m_cells[i] = mem[m_memMapAddr + i];
+    }
+    std::fill(outFrame.m_cells + count, outFrame.m_cells + CellCount, 0);
+    std::copy(m_font, m_font + FontWords, outFrame.m_font);
+    std::copy(m_palette, m_palette + PaletteWords, outFrame.m_palette);
+    outFrame.m_fontVersion = m_fontVersion;
+    outFrame.m_paletteVersion = m_paletteVersion;
+    outFrame.m_borderColor = m_borderColor;
+    outFrame.m_blinkSwap = m_blinkSwap;
+}
+
+void Monitor::render(const Frame& frame) {
+    // a new font or palette redraws everything, blinking cells change with
+    // the phase and the others only with their word
+    bool isRedrawn = !m_hasDrawnFrame;
+    if (frame.m_fontVersion != m_glyphsVersion) {
+        buildGlyphs(frame.m_font);
+        m_glyphsVersion = frame.m_fontVersion;
+        isRedrawn = true;
+    }
+    if (frame.m_paletteVersion != m_colorsVersion) {
+        buildColors(frame.m_palette);
+        m_colorsVersion = frame.m_paletteVersion;
+        isRedrawn = true;
+    }
+    const bool isBlinkChanged = isRedrawn || frame.m_blinkSwap != m_drawnFrame.m_blinkSwap;
+    bool isChanged = false;
+    for (word_t i=0; i<CellCount; ++i) {
+        const word_t data = frame.m_cells[i];
+        if (!isRedrawn && data == m_drawnFrame.m_cells[i] && !(isBlinkChanged && (data & 0x80)))
+            continue;
+        displayChr(data, i, frame.m_blinkSwap);
+        isChanged = true;
+    }
+    m_drawnFrame = frame;
+    m_hasDrawnFrame = true;
+    m_display->present(m_pixels, isChanged);
 }
 
 cycles_t Monitor::interrupt(DCPU& cpu, Memory& mem) {
@@ -220,13 +343,13 @@ cycles_t Monitor::interrupt(DCPU& cpu, Memory& mem) {
 }
 
 void Monitor::dumpFontAtAddress(Memory& mem, word_t addr) const{
-    for (word_t i=0; i<256; ++i) {
-        *(mem + addr) = default_font[i];
+    for (word_t i=0; i<FontWords; ++i) {
+        mem.Write(addr + i, default_font[i]);
     }
 }
 
 void Monitor::dumpPalletteAtAddress(Memory& mem, word_t addr) const{
-    for (word_t i=0; i<16; ++i) {
-        *(mem + addr) = m_defaultPalette[i];
+    for (word_t i=0; i<PaletteWords; ++i) {
+        mem.Write(addr + i, m_defaultPalette[i]);
     }
 }
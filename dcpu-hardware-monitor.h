@@ -1,18 +1,57 @@
 #pragma once
 #include <dcpu-hardware.h>
 #include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
 
-class SDL_Renderer;
-class SDL_Texture;
-class SDL_Window;
+//
+// Where the monitor frames go (a window, an offscreen framebuffer, ...). The
+// calls come from the thread drawing the frames, open before the first frame
+// and close after the last one.
+//
+class MonitorDisplay {
+public:
+    virtual ~MonitorDisplay() {}
+    virtual void open() {}
+    virtual void close() {}
+    // Monitor::Width x Monitor::Height RGBA4444 pixels, isChanged is false
+    // when they are the same as for the previous frame
+    virtual void present(const word_t* pixels, bool isChanged) = 0;
+    // Displays wanting every frame are drawn on the cpu thread, the others on
+    // a render thread dropping the frames it is too slow for.
+    virtual bool needsEveryFrame() const { return false; }
+};
 
+//
+// LEM1802 display. The cpu thread only copies the mapped screen into a frame
+// 60 times per second (of cpu or host time) and hands it to a render thread
+// owning the display, a frame the renderer has not taken yet is replaced by
+// the next one so a slow display drops frames instead of slowing the cpu.
+// Without a display the frames are not drawn at all.
+//
 class Monitor : public Hardware {
 public:
+    static constexpr long_t FramesPerSecond = 60;
+    static constexpr cycles_t PollCycles = 1000;   // the wall clock is read at most this far apart
+    static constexpr word_t Width = 128;
+    static constexpr word_t Height = 96;
+
     Monitor();
     ~Monitor() override;
     cycles_t update(DCPU& cpu, Memory& mem) override;
     cycles_t interrupt(DCPU& cpu, Memory& mem) override;
+    cycles_t nextEvent(const DCPU& cpu) const override;
+    void saveState(vector<uint32_t>& outState) const override;
+    bool checkState(const vector<uint32_t>& state) const override;
+    void loadState(const DCPU& cpu, const vector<uint32_t>& state) override;
+
+    void setTimeMode(ClockTime mode) { m_timeMode = mode; }
+    ClockTime getTimeMode() const { return m_timeMode; }
+    // replaces the display, the previous one is closed
+    void setDisplay(std::unique_ptr<MonitorDisplay> display);
 
 private:
     enum InterruptCommands {
@@ -25,16 +64,36 @@ private:
     };
     static constexpr word_t CharWidth = 4;
     static constexpr word_t CharHeight = 8;
-    static constexpr word_t Width = 128;
-    static constexpr word_t Height = 96;
     static constexpr word_t RowWidth = Width / CharWidth;
-    static constexpr word_t PixelZoom = 4;
+    static constexpr word_t CellCount = RowWidth * (Height / CharHeight);
+    static constexpr word_t FontWords = 256;
+    static constexpr word_t PaletteWords = 16;
     static constexpr float BlinkDelay = 0.5f;
 
     using time = std::chrono::time_point<std::chrono::system_clock>;
 
+    // what the renderer needs of the machine, copied on the cpu thread
+    struct Frame {
+        word_t m_cells[CellCount];
+        word_t m_font[FontWords];
+        word_t m_palette[PaletteWords];
+        long_t m_fontVersion;           // the glyphs and colors are only decoded again
+        long_t m_paletteVersion;        // when their version changes
+        word_t m_borderColor;
+        bool m_blinkSwap;
+    };
+
     void initializeDefaults();
-    void displayChr(word_t data, word_t i, word_t* pixels);
+    void publishFrame(const DCPU& cpu, const Memory& mem);
+    void refreshMapped(const Memory& mem, word_t addr, const word_t* defaults, word_t count,
+                       word_t* cache, long_t& version);
+    void copyFrame(const Memory& mem, Frame& outFrame) const;
+    void renderLoop();
+    void stopRendering();
+    void render(const Frame& frame);
+    void buildGlyphs(const word_t* font);
+    void buildColors(const word_t* palette);
+    void displayChr(word_t data, word_t i, bool blinkSwap);
     void dumpFontAtAddress(Memory& mem, word_t addr) const;
     void dumpPalletteAtAddress(Memory& mem, word_t addr) const;
     
@@ -42,13 +101,33 @@ private:
     word_t m_memFontAddr = 0;
     word_t m_memPaletteAddr = 0;
     word_t m_borderColor = 0;
+    ClockTime m_timeMode = ClockTime_Virtual;
+    time m_frameTime;
     time m_blinkTime;
     bool m_blinkSwap = false;
 
-    static const word_t default_font[256];
-    word_t m_defaultPalette[16];
+    static const word_t default_font[FontWords];
+    word_t m_defaultPalette[PaletteWords];
+    word_t m_font[FontWords];           // the mapped or default font as of the last frame
+    word_t m_palette[PaletteWords];
+    long_t m_fontVersion = 0;
+    long_t m_paletteVersion = 0;
+
+    std::mutex m_frameMutex;            // guards the members up to m_renderThread
+    std::condition_variable m_frameCondition;
+    Frame m_pendingFrame;               // the latest frame, taken by the renderer
+    bool m_hasPendingFrame = false;
+    bool m_isQuitting = false;
+    std::thread m_renderThread;
 
-    SDL_Window* m_window = nullptr;
-    SDL_Renderer* m_renderer = nullptr;
-    SDL_Texture* m_screenTexture = nullptr;
+    // only used on the thread drawing the frames, the pixels are kept across
+    // frames and only the cells that changed since m_drawnFrame are drawn again
+    std::unique_ptr<MonitorDisplay> m_display;
+    uint64_t m_glyphRows[128][CharHeight];  // a 16 bit lane per pixel, all ones where the glyph is set
+    uint64_t m_colorRows[PaletteWords];     // each palette color repeated over a glyph row
+    long_t m_glyphsVersion = 0;
+    long_t m_colorsVersion = 0;
+    word_t m_pixels[Width*Height];
+    Frame m_drawnFrame;
+    bool m_hasDrawnFrame = false;
 };
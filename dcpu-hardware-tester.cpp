@@ -7,16 +7,41 @@ TesterDevice::TesterDevice() {
     
 }
 
+TesterDevice::~TesterDevice() {
+    if (m_poster.joinable()) {
+        m_poster.join();
+    }
+}
+
 cycles_t TesterDevice::update(DCPU& cpu, Memory& mem) {
+    m_eventCycle = NoEvent;
+    cpu.interrupt(m_id);
     return 0;
 }
 
+cycles_t TesterDevice::nextEvent(const DCPU& cpu) const {
+    return m_eventCycle;
+}
+
+void TesterDevice::saveState(vector<uint32_t>& outState) const {
+    outState.insert(outState.end(), {m_lastkey, m_eventCycle});
+}
+
+bool TesterDevice::checkState(const vector<uint32_t>& state) const {
+    return state.size() == 2;
+}
+
+void TesterDevice::loadState(const DCPU& cpu, const vector<uint32_t>& state) {
+    m_lastkey = static_cast<word_t>(state[0]);
+    m_eventCycle = state[1];
+}
+
 cycles_t TesterDevice::interrupt(DCPU& cpu, Memory& mem) {
     const word_t a = cpu.getRegister(Registers_A);
     if (m_lastkey != 0) {
         const word_t res = a == m_lastkey ? 123 : 0xFFFF;
         cpu.setSP(cpu.getSP() - 1);
-        mem[cpu.getSP()] = res;
+        mem.Write(cpu.getSP(), res);
         m_lastkey = 0;
     } else {
         switch(a) {
@@ -30,6 +55,76 @@ cycles_t TesterDevice::interrupt(DCPU& cpu, Memory& mem) {
             cpu.interrupt(m_id);
             break;
         }
+        case 2: {   // interrupt in B cycles
+            m_eventCycle = cpu.getCycles() + cpu.getRegister(Registers_B);
+            break;
+        }
+        case 3: {   // B interrupts posted from another thread
+            if (m_poster.joinable()) {
+                m_poster.join();
+            }
+            const word_t count = cpu.getRegister(Registers_B);
+            const long_t message = m_id;
+            m_poster = std::thread([&cpu, count, message]() {
+                for (word_t i=0; i<count; ++i) {
+                    while (!cpu.postInterrupt(message)) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+            break;
+        }
+        }
+    }
+    return 0;
+}
+
+class AsyncTesterDevice::Worker : public DeviceWorker {
+public:
+    void process(const DeviceRequest& request, DeviceReply& outReply) override {
+        std::this_thread::sleep_for(std::chrono::microseconds{m_delay.load()});
+        if (request.m_kind == DeviceRequestKind_Update) {
+            outReply.m_interrupts.push_back(TickMessage);
+            outReply.scheduleUpdate(request.m_cycle + m_period);
+            return;
+        }
+        switch (request.m_registers[Registers_A]) {
+        case 0: {   // sum of the B words at X written to Y
+            word_t sum = 0;
+            for (word_t value : request.m_data) {
+                sum += value;
+            }
+            outReply.m_writeAddr = request.m_registers[Registers_Y];
+            outReply.m_writes.push_back(sum);
+            outReply.m_interrupts.push_back(SumMessage);
+            break;
+        }
+        case 1: {   // tick every B cycles, 0 stops
+            m_period = request.m_registers[Registers_B];
+            outReply.scheduleUpdate(m_period == 0 ? NoEvent : request.m_cycle + m_period);
+            break;
+        }
+        }
+    }
+
+    std::atomic<long_t> m_delay {0};
+    cycles_t m_period = 0;
+};
+
+AsyncTesterDevice::AsyncTesterDevice()
+    : AsyncHardware {std::make_unique<Worker>(), Latency}
+{
+}
+
+void AsyncTesterDevice::setWorkerDelay(std::chrono::microseconds delay) {
+    static_cast<Worker&>(getWorker()).m_delay.store(static_cast<long_t>(delay.count()));
+}
+
+cycles_t AsyncTesterDevice::prepare(const DCPU& cpu, const Memory& mem, DeviceRequest& request) {
+    if (request.m_kind == DeviceRequestKind_Interrupt && cpu.getRegister(Registers_A) == 0) {
+        const word_t addr = cpu.getRegister(Registers_X);
+        for (word_t i=0; i<cpu.getRegister(Registers_B); ++i) {
+            request.m_data.push_back(mem[static_cast<word_t>(addr + i)]);
         }
     }
     return 0;
@@ -1,5 +1,8 @@
 #pragma once
 #include <dcpu-hardware.h>
+#include <dcpu-hardware-async.h>
+#include <chrono>
+#include <thread>
 
 //
 // device meant only to test the API
@@ -7,9 +10,37 @@
 class TesterDevice : public Hardware {
 public:
     TesterDevice();
+    ~TesterDevice() override;
     cycles_t update(DCPU& cpu, Memory& mem) override;
     cycles_t interrupt(DCPU& cpu, Memory& mem) override;
+    cycles_t nextEvent(const DCPU& cpu) const override;
+    void saveState(vector<uint32_t>& outState) const override;
+    bool checkState(const vector<uint32_t>& state) const override;
+    void loadState(const DCPU& cpu, const vector<uint32_t>& state) override;
 
 private:
     word_t m_lastkey = 0;
+    cycles_t m_eventCycle = NoEvent;
+    std::thread m_poster;
+};
+
+//
+// asynchronous device meant only to test AsyncHardware, its worker can be
+// slowed down to check the guest does not notice
+//
+class AsyncTesterDevice : public AsyncHardware {
+public:
+    static constexpr cycles_t Latency = 100;
+    static constexpr word_t SumMessage = 1;
+    static constexpr word_t TickMessage = 2;
+
+    AsyncTesterDevice();
+    // host time the worker spends on each request
+    void setWorkerDelay(std::chrono::microseconds delay);
+
+protected:
+    cycles_t prepare(const DCPU& cpu, const Memory& mem, DeviceRequest& request) override;
+
+private:
+    class Worker;
 };
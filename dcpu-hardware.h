@@ -1,15 +1,38 @@
 #pragma once
 #include <dcpu-types.h>
+#include <vector>
+
+using std::vector;
 
 class DCPU;
 class Memory;
 
+// time base of the devices with periodic events (clock ticks, monitor frames)
+enum ClockTime {
+    ClockTime_Virtual,      // derived from the cpu cycles at the nominal 100 kHz
+    ClockTime_Wall,         // follows the host clock, for interactive use
+};
+
 class Hardware {
 public:
+    static constexpr cycles_t NoEvent = 0xFFFFFFFF;
+
     virtual ~Hardware() {};
     void init(deviceIdx_t deviceIndex);
+    // called once the event announced by nextEvent is due
     virtual cycles_t update(DCPU& cpu, Memory& mem) = 0;
     virtual cycles_t interrupt(DCPU& cpu, Memory& mem) = 0;
+    // cycle of the next event (tick, interrupt, refresh), NoEvent if the
+    // device only answers HWI. Asked again after every update and interrupt.
+    virtual cycles_t nextEvent(const DCPU& cpu) const { return NoEvent; }
+    // the cpu fast-forwarded an idle loop by that many cycles
+    virtual void onIdle(cycles_t cycles) {}
+    // device state for snapshots, checkState is false when what saveState
+    // appended does not fit the device, loadState then applies it once the
+    // cpu state is loaded
+    virtual void saveState(vector<uint32_t>& outState) const {}
+    virtual bool checkState(const vector<uint32_t>& state) const { return state.empty(); }
+    virtual void loadState(const DCPU& cpu, const vector<uint32_t>& state) {}
 
     long_t getId() const { return m_id; }
     word_t getVersion() const { return m_version; }
@@ -0,0 +1,81 @@
+#pragma once
+#include <dcpu-types.h>
+#include <atomic>
+
+//
+// Bounded lock-free queue of interrupt messages, many producers and a single
+// consumer. Each cell carries a sequence number telling whose turn it is
+// (after Dmitry Vyukov's bounded queue): producers claim a position with a
+// CAS on the tail then publish the cell, the consumer owns the head and only
+// reads cells published for its position. Any thread can post, the cpu
+// thread drains between instructions.
+//
+class InterruptChannel {
+public:
+    static constexpr uint32_t Capacity = 256;
+
+    InterruptChannel();
+    InterruptChannel(const InterruptChannel&) = delete;
+    InterruptChannel& operator=(const InterruptChannel&) = delete;
+
+    // thread safe, false when the channel is full
+    bool post(word_t message);
+    // consumer side only
+    bool hasMessage() const;
+    bool receive(word_t& outMessage);
+
+private:
+    static_assert((Capacity & (Capacity - 1)) == 0, "positions are masked with Capacity - 1");
+
+    struct Cell {
+        std::atomic<uint32_t> m_sequence;
+        word_t m_message;
+    };
+
+    alignas(64) std::atomic<uint32_t> m_tail;
+    alignas(64) uint32_t m_head = 0;
+    Cell m_cells[Capacity];
+};
+
+inline InterruptChannel::InterruptChannel()
+    : m_tail {0}
+{
+    for (uint32_t i=0; i<Capacity; ++i) {
+        m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+inline bool InterruptChannel::post(word_t message) {
+    uint32_t pos = m_tail.load(std::memory_order_relaxed);
+    while (true) {
+        Cell& cell = m_cells[pos & (Capacity - 1)];
+        const uint32_t sequence = cell.m_sequence.load(std::memory_order_acquire);
+        const int32_t diff = static_cast<int32_t>(sequence - pos);
+        if (diff == 0) {
+            if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.m_message = message;
+                cell.m_sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false; // the consumer has not freed this cell yet
+        } else {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+inline bool InterruptChannel::hasMessage() const {
+    const Cell& cell = m_cells[m_head & (Capacity - 1)];
+    return cell.m_sequence.load(std::memory_order_acquire) == m_head + 1;
+}
+
+inline bool InterruptChannel::receive(word_t& outMessage) {
+    if (!hasMessage())
+        return false;
+    Cell& cell = m_cells[m_head & (Capacity - 1)];
+    outMessage = cell.m_message;
+    cell.m_sequence.store(m_head + Capacity, std::memory_order_release);
+    ++m_head;
+    return true;
+}
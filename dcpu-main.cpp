@@ -1,48 +1,107 @@
 #include <dcpu.h>
 #include <dcpu-mem.h>
-#include <dcpu-codex.h>
 #include <dcpu-hardware-clock.h>
-#include <dcpu-hardware-monitor.h>
-#include <vector>
-#include <fstream>
-
-using std::vector;
-
-word_t load_program(Memory& mem, const vector<byte_t>& codebytes) {
-    vector<word_t> codeWords = Codex::PackBytes(codebytes);
-    vector<Instruction> instructions = Codex::Decode(codeWords);
-    return mem.LoadProgram(codeWords);
-}
+#include <dcpu-hardware-monitor-headless.h>
+#if !defined(DCPU_HEADLESS)
+#include <dcpu-hardware-monitor-sdl.h>
+#endif
+#include <dcpu-snapshot.h>
+#include <algorithm>
+#include <cstdlib>
 
 int main(int argc, char** args) {
-    if (argc != 2) {
-        printf("usage: dcpu <program-bin-file>\n");
-        return 1;
+    EngineType engine = EngineType_Switch;
+    bool usePeephole = true;
+    TimingMode timing = TimingMode_CycleAccurate;
+    ClockTime clockTime = ClockTime_Wall;
+    const char* filename = nullptr;
+    const char* loadSnapshot = nullptr;
+    const char* saveSnapshot = nullptr;
+    const char* capturePattern = nullptr;
+    CaptureFormat captureFormat = CaptureFormat_PPM;
+    cycles_t budget = DCPU::NoCycleBudget;
+    for (int i=1; i<argc; ++i) {
+        if (string{args[i]} == "--engine" && i+1 < argc) {
+            engine = StrToEngineType(args[++i]);
+        } else if (string{args[i]} == "--no-peephole") {
+            usePeephole = false;
+        } else if (string{args[i]} == "--functional") {
+            timing = TimingMode_Functional;
+        } else if (string{args[i]} == "--virtual-clock") {
+            clockTime = ClockTime_Virtual;
+        } else if (string{args[i]} == "--load-snapshot" && i+1 < argc) {
+            loadSnapshot = args[++i];
+        } else if (string{args[i]} == "--save-snapshot" && i+1 < argc) {
+            saveSnapshot = args[++i];
+        } else if (string{args[i]} == "--capture" && i+1 < argc) {
+            capturePattern = args[++i];
+        } else if (string{args[i]} == "--capture-format" && i+1 < argc) {
+            captureFormat = StrToCaptureFormat(args[++i]);
+        } else if (string{args[i]} == "--budget" && i+1 < argc) {
+            budget = std::strtoul(args[++i], nullptr, 0);
+        } else {
+            filename = args[i];
+        }
     }
-
-    vector<byte_t> rawbytes;
-    std::ifstream binFileStream(args[1], std::ios::binary);
-    if (!binFileStream.is_open()) {
-        printf("failed to open file: %s\n", args[1]);
+    if ((filename == nullptr && loadSnapshot == nullptr) || engine == EngineType_Count
+        || captureFormat == CaptureFormat_Count) {
+        printf("usage: dcpu [--engine name] [--no-peephole] [--functional] [--virtual-clock]\n"
+               "            [--budget cycles] [--load-snapshot file] [--save-snapshot file]\n"
+               "            [--capture pattern] [--capture-format raw|ppm|png] <program-bin-file>\n");
+        printf("engines:");
+        for (int i=0; i<EngineType_Count; ++i) {
+            printf(" %s", EngineTypeToStr(static_cast<EngineType>(i)));
+        }
+        printf("\n");
         return 1;
-    } 
-    while(!binFileStream.eof()){
-        byte_t& halfword = rawbytes.emplace_back();
-        binFileStream.read(reinterpret_cast<char*>(&halfword), 1);
     }
-    binFileStream.close();
 
     Memory mem;
-    DCPU cpu;
-    cpu.addDevice<Clock>();
-    cpu.addDevice<Monitor>();
-    const word_t lastProgramAddr = load_program(mem, rawbytes);
+    DCPU cpu{timing};
+    cpu.setPeepholeEnabled(usePeephole);
+    cpu.setEngine(engine);
+    cpu.addDevice<Clock>()->setTimeMode(clockTime);
+    Monitor* monitor = cpu.addDevice<Monitor>();
+    monitor->setTimeMode(clockTime);
+    if (capturePattern != nullptr) {
+        monitor->setDisplay(std::make_unique<HeadlessDisplay>(capturePattern, captureFormat));
+    } else {
+#if !defined(DCPU_HEADLESS)
+        monitor->setDisplay(std::make_unique<SdlDisplay>());
+#endif
+    }
 
-    while(cpu.getPC() < lastProgramAddr) {
-        cpu.step(mem);
+    if (loadSnapshot != nullptr) {
+        if (!Snapshot::Load(loadSnapshot, cpu, mem)) {
+            printf("failed to load snapshot: %s\n", loadSnapshot);
+            return 1;
+        }
+    } else {
+        long_t wordCount = 0;
+        if (!mem.MapProgram(filename, wordCount)) {
+            printf("failed to open file: %s\n", filename);
+            return 1;
+        }
+        cpu.setPCLimit(wordCount);
+    }
+
+    // a budget stops the run midway, to save a snapshot there
+    const cycles_t start = cpu.getCycles();
+    StopReason reason = StopReason_Interrupt;
+    while (reason == StopReason_Interrupt) {
+        const cycles_t elapsed = cpu.getCycles() - start;
+        reason = cpu.runFor(mem, budget == DCPU::NoCycleBudget ? budget : budget - std::min(elapsed, budget));
+    }
+    if (reason == StopReason_OnFire) {
+        printf("the interrupt queue overflowed, the DCPU caught fire\n");
     }
     cpu.printRegisters();
     mem.Dump(0xFFF0, 0xFFFF);
 
+    if (saveSnapshot != nullptr && !Snapshot::Save(saveSnapshot, cpu, mem)) {
+        printf("failed to save snapshot: %s\n", saveSnapshot);
+        return 1;
+    }
+
     return 0;
 }
@@ -0,0 +1,47 @@
+#include <dcpu-mapped-file.h>
+#include <dcpu-mem.h>
+#include <fstream>
+#include <iterator>
+
+#if DCPU_COW_MEMORY
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const string& path) {
+#if DCPU_COW_MEMORY
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    struct stat status;
+    if (fstat(fd, &status) == 0) {
+        m_isOpen = true;
+        m_size = static_cast<size_t>(status.st_size);
+        void* data = m_size != 0 ? mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (data != MAP_FAILED) {
+            m_data = static_cast<const byte_t*>(data);
+            m_isMapped = true;
+        }
+    }
+    close(fd);  // the mapping stays
+    if (m_isMapped || !m_isOpen)
+        return;
+#endif
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream.is_open())
+        return;
+    m_bytes.assign(std::istreambuf_iterator<char>(stream), {});
+    m_isOpen = true;
+    m_data = m_bytes.data();
+    m_size = m_bytes.size();
+}
+
+MappedFile::~MappedFile() {
+#if DCPU_COW_MEMORY
+    if (m_isMapped) {
+        munmap(const_cast<byte_t*>(m_data), m_size);
+    }
+#endif
+}
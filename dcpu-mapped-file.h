@@ -0,0 +1,29 @@
+#pragma once
+#include <dcpu-types.h>
+#include <cstddef>
+#include <vector>
+
+using std::vector;
+
+//
+// Read only view of a whole file. Mapped where supported so the pages are
+// only read as they are used, read in one go elsewhere.
+//
+class MappedFile {
+public:
+    explicit MappedFile(const string& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    bool isOpen() const { return m_isOpen; }
+    const byte_t* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    bool m_isOpen = false;
+    const byte_t* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_isMapped = false;
+    vector<byte_t> m_bytes;     // when not mapped
+};
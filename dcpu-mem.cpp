@@ -1,15 +1,296 @@
 #include <dcpu-mem.h>
+#include <dcpu-assert.h>
+#include <dcpu-codex.h>
+#include <dcpu-mapped-file.h>
+#include <algorithm>
+#include <cerrno>
+#include <fstream>
+
+#if DCPU_COW_MEMORY
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MemoryObserver::~MemoryObserver() {
+    detach();
+}
+
+void MemoryObserver::attach(Memory& mem) {
+    if (m_mem == &mem)
+        return;
+    detach();
+    m_mem = &mem;
+    mem.AddObserver(this);
+}
+
+void MemoryObserver::detach() {
+    if (m_mem == nullptr)
+        return;
+    m_mem->RemoveObserver(this);
+    m_mem = nullptr;
+    onMemoryDetached();
+}
+
+MemoryImage::MemoryImage(const word_t* words) {
+#if DCPU_COW_MEMORY
+    m_fd = memfd_create("dcpu-memory", MFD_CLOEXEC);
+    if (m_fd >= 0 && pwrite(m_fd, words, Memory::TotalBytes, 0) != static_cast<ssize_t>(Memory::TotalBytes)) {
+        close(m_fd);
+        m_fd = -1;
+    }
+#endif
+    if (m_fd < 0) {
+        m_words.assign(words, words + Memory::LastValidAddress+1);
+    }
+}
+
+std::shared_ptr<const MemoryImage> MemoryImage::FromFile(const string& path, long_t offset) {
+    std::shared_ptr<MemoryImage> image{new MemoryImage{}};
+    image->m_offset = offset;
+#if DCPU_COW_MEMORY
+    image->m_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (image->m_fd >= 0 && fstat(image->m_fd, &status) == 0
+        && status.st_size >= static_cast<off_t>(offset) + Memory::TotalBytes) {
+        return image;
+    }
+    if (image->m_fd >= 0) {
+        close(image->m_fd);
+        image->m_fd = -1;
+    }
+#endif
+    std::ifstream stream(path, std::ios::binary);
+    image->m_words.resize(Memory::LastValidAddress+1);
+    stream.seekg(offset);
+    stream.read(reinterpret_cast<char*>(image->m_words.data()), Memory::TotalBytes);
+    return stream ? image : nullptr;
+}
+
+MemoryImage::~MemoryImage() {
+#if DCPU_COW_MEMORY
+    if (m_fd >= 0) {
+        close(m_fd);    // the mappings keep the file alive
+    }
+#endif
+}
 
 Memory::Memory() {
-    std::memset(this, 0, TotalBytes);
+#if DCPU_COW_MEMORY
+    // zero pages are only backed once written
+    void* buffer = mmap(nullptr, TotalBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer != MAP_FAILED) {
+        m_Buffer = static_cast<word_t*>(buffer);
+        m_isMapped = true;
+    }
+#endif
+    if (m_Buffer == nullptr) {
+        m_Buffer = new word_t[LastValidAddress+1]();
+    }
+    std::memset(m_watched, 0, sizeof(m_watched));
+#if DCPU_DIRTY_TRACKING
+    ClearDirty();
+#endif
+}
+
+Memory::Memory(const std::shared_ptr<const MemoryImage>& image)
+    : Memory()
+{
+    MapImage(*image);
+}
+
+Memory::Memory(const Memory& other)
+    : Memory()
+{
+    std::memcpy(m_Buffer, other.m_Buffer, TotalBytes);
+}
+
+Memory& Memory::operator=(const Memory& other) {
+    if (this != &other) {
+        std::memcpy(m_Buffer, other.m_Buffer, TotalBytes);
+        MarkDirty(0, LastValidAddress+1);
+        TouchWatched();
+    }
+    return *this;
+}
+
+void Memory::TouchWatched() {
+    for (word_t block=0; block<WatchBlockCount; ++block) {
+        if (m_watched[block] == 0)
+            continue;
+        for (word_t bit=0; bit<64; ++bit) {
+            Touch(static_cast<word_t>(block*64 + bit));
+        }
+    }
+}
+
+Memory::~Memory() {
+    while (!m_observers.empty()) {
+        m_observers.back()->detach();
+    }
+#if DCPU_COW_MEMORY
+    if (m_isMapped) {
+        munmap(m_Buffer, TotalBytes);
+        return;
+    }
+#endif
+    delete[] m_Buffer;
+}
+
+std::shared_ptr<const MemoryImage> Memory::Freeze() {
+    std::shared_ptr<const MemoryImage> image = std::make_shared<MemoryImage>(m_Buffer);
+    MapImage(*image);
+    return image;
 }
 
-word_t Memory::LoadProgram(const vector<word_t>& codebytes){
-    for(word_t addr=0; addr < codebytes.size(); ++addr) {
+void Memory::LoadImage(const std::shared_ptr<const MemoryImage>& image) {
+    MapImage(*image);
+    MarkDirty(0, LastValidAddress+1);
+    TouchWatched();
+}
+
+void Memory::Clear() {
+    std::memset(m_Buffer, 0, TotalBytes);
+    MarkDirty(0, LastValidAddress+1);
+    TouchWatched();
+}
+
+void Memory::MarkDirty(long_t addr, long_t count) {
+#if DCPU_DIRTY_TRACKING
+    if (count > 0) {
+        std::memset(m_dirtyPages + addr / DirtyPageWords, 1, (addr + count - 1) / DirtyPageWords - addr / DirtyPageWords + 1);
+    }
+#endif
+}
+
+#if DCPU_DIRTY_TRACKING
+bool Memory::IsDirty(word_t addr, long_t count) const {
+    if (count == 0)
+        return false;
+    for (long_t page = addr / DirtyPageWords; page <= (addr + count - 1) / DirtyPageWords; ++page) {
+        if (m_dirtyPages[page % DirtyPageCount])
+            return true;
+    }
+    return false;
+}
+
+void Memory::ClearDirty(word_t addr, long_t count) {
+    if (count == 0)
+        return;
+    for (long_t page = addr / DirtyPageWords; page <= (addr + count - 1) / DirtyPageWords; ++page) {
+        m_dirtyPages[page % DirtyPageCount] = 0;
+    }
+}
+#endif
+
+void Memory::MapImage(const MemoryImage& image) {
+#if DCPU_COW_MEMORY
+    // mapped over the current buffer, pointers into it stay valid
+    if (m_isMapped && image.m_fd >= 0) {
+        void* buffer = mmap(m_Buffer, TotalBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, image.m_fd,
+                            image.m_offset);
+        dcpu_assert_fmt(buffer == m_Buffer, "Failed to map memory image: %d", errno);
+        return;
+    }
+#endif
+    const word_t* words = image.m_words.data();
+#if DCPU_COW_MEMORY
+    vector<word_t> content;
+    if (image.m_fd >= 0) {
+        content.resize(LastValidAddress+1);
+        const ssize_t bytes = pread(image.m_fd, content.data(), TotalBytes, image.m_offset);
+        dcpu_assert_fmt(bytes == static_cast<ssize_t>(TotalBytes), "Failed to read memory image: %d", errno);
+        words = content.data();
+    }
+#endif
+    std::memcpy(m_Buffer, words, TotalBytes);
+}
+
+long_t Memory::LoadProgram(const vector<word_t>& codebytes){
+    const long_t wordCount = static_cast<long_t>(std::min<size_t>(codebytes.size(), LastValidAddress+1));
+    for(long_t addr=0; addr < wordCount; ++addr) {
         // printf("codemem[%04X] = %04X\n", addr, codebytes[addr]);
-        m_Buffer[addr] = codebytes[addr];
+        Write(static_cast<word_t>(addr), codebytes[addr]);
+    }
+    return wordCount;
+}
+
+long_t Memory::LoadProgram(const byte_t* bytes, size_t byteCount) {
+    const long_t wordCount = static_cast<long_t>(std::min<size_t>((byteCount + 1) / WordByteCount, LastValidAddress+1));
+    const long_t pairCount = std::min<long_t>(wordCount, byteCount / WordByteCount);
+    Codex::PackBytes(bytes, pairCount, m_Buffer);
+    if (pairCount < wordCount) {
+        m_Buffer[pairCount] = bytes[byteCount - 1];
+    }
+    MarkDirty(0, wordCount);
+    for (long_t addr=0; addr<wordCount && !m_observers.empty(); ++addr) {
+        Touch(static_cast<word_t>(addr));
+    }
+    return wordCount;
+}
+
+bool Memory::MapProgram(const string& path, long_t& outWordCount) {
+#if DCPU_COW_MEMORY && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    const int fd = m_isMapped ? open(path.c_str(), O_RDONLY | O_CLOEXEC) : -1;
+    struct stat status;
+    if (fd >= 0 && (fstat(fd, &status) != 0 || !S_ISREG(status.st_mode))) {
+        close(fd);      // pipes and devices are read below
+    } else if (fd >= 0) {
+        // whole pages of the file, the tail of the last one reads as zeros,
+        // anonymous zero pages after them
+        const size_t byteCount = std::min<size_t>(status.st_size, TotalBytes);
+        const size_t pageBytes = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        const size_t fileBytes = (byteCount + pageBytes - 1) / pageBytes * pageBytes;
+        byte_t* buffer = reinterpret_cast<byte_t*>(m_Buffer);
+        if (fileBytes > 0) {
+            void* mapped = mmap(buffer, fileBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+            dcpu_assert_fmt(mapped == buffer, "Failed to map program: %d", errno);
+        }
+        close(fd);
+        if (fileBytes < TotalBytes) {
+            void* mapped = mmap(buffer + fileBytes, TotalBytes - fileBytes, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+            dcpu_assert_fmt(mapped == buffer + fileBytes, "Failed to map memory: %d", errno);
+        }
+        outWordCount = static_cast<long_t>((byteCount + 1) / WordByteCount);
+        MarkDirty(0, LastValidAddress+1);
+        TouchWatched();
+        return true;
+    }
+#endif
+    const MappedFile file{path};
+    if (!file.isOpen())
+        return false;
+    std::memset(m_Buffer, 0, TotalBytes);
+    outWordCount = LoadProgram(file.data(), file.size());
+    MarkDirty(0, LastValidAddress+1);
+    TouchWatched();
+    return true;
+}
+
+void Memory::Watch(word_t addr, word_t count) {
+    for (word_t i=0; i<count; ++i) {
+        const word_t a = addr+i;
+        m_watched[a >> 6] |= uint64_t{1} << (a & 0x3F);
+    }
+}
+
+void Memory::NotifyWrite(word_t addr) {
+    for (MemoryObserver* observer : m_observers) {
+        observer->onMemoryWrite(addr);
+    }
+}
+
+void Memory::AddObserver(MemoryObserver* observer) {
+    m_observers.push_back(observer);
+}
+
+void Memory::RemoveObserver(MemoryObserver* observer) {
+    m_observers.erase(std::remove(m_observers.begin(), m_observers.end(), observer), m_observers.end());
+    if (m_observers.empty()) {
+        std::memset(m_watched, 0, sizeof(m_watched));
     }
-    return codebytes.size();
 }
 
 void Memory::Dump(word_t from, word_t to) const {
@@ -3,25 +3,162 @@
 #include <dcpu-types.h>
 #include <cstdio>
 #include <cstring>
+#include <memory>
 #include <vector>
 
 using std::vector;
 
+#if defined(__linux__)
+#define DCPU_COW_MEMORY 1
+#else
+#define DCPU_COW_MEMORY 0
+#endif
+
+// Page granular tracking of the written words, off unless a build asks for it
+#ifndef DCPU_DIRTY_TRACKING
+#define DCPU_DIRTY_TRACKING 0
+#endif
+
+class Memory;
+
+//
+// Interface for caches derived from memory content (decoded instructions,
+// translated code, ...). Observers mark the words they depend on with
+// Memory::Watch and get notified when one of those words is written.
+//
+class MemoryObserver {
+public:
+    MemoryObserver() {}
+    MemoryObserver(const MemoryObserver&) {}
+    MemoryObserver& operator=(const MemoryObserver&) { return *this; }
+    virtual ~MemoryObserver();
+
+    void attach(Memory& mem);
+    void detach();
+    bool isAttachedTo(const Memory& mem) const { return m_mem == &mem; }
+
+    virtual void onMemoryWrite(word_t addr) = 0;
+    virtual void onMemoryDetached() {}
+
+protected:
+    Memory* m_mem = nullptr;
+};
+
+//
+// Frozen memory content any number of Memory instances can start from. Where
+// supported it lives in an anonymous file each of them maps privately, pages
+// stay shared until an instance writes to one and the host copies that page
+// only. Elsewhere every instance copies the whole content.
+//
+class MemoryImage {
+public:
+    explicit MemoryImage(const word_t* words);
+    MemoryImage(const MemoryImage&) = delete;
+    MemoryImage& operator=(const MemoryImage&) = delete;
+    ~MemoryImage();
+
+    // Image of the Memory::TotalBytes at offset in the file (words in host
+    // byte order), the file is mapped where supported and must then not be
+    // changed while in use. nullptr on failure.
+    static std::shared_ptr<const MemoryImage> FromFile(const string& path, long_t offset);
+
+private:
+    friend class Memory;
+    MemoryImage() {}
+
+    int m_fd = -1;              // backing file, -1 when m_words holds the content
+    long_t m_offset = 0;
+    vector<word_t> m_words;
+};
+
 class Memory {
 public:
     static constexpr word_t WordByteCount = 2;
     static constexpr word_t LastValidAddress = 0xFFFF;
     static constexpr long_t TotalBytes = (LastValidAddress+1)*WordByteCount;
+    static constexpr long_t DirtyPageWords = 64;
+    static constexpr long_t DirtyPageCount = (LastValidAddress+1) / DirtyPageWords;
 
     Memory();
-    word_t LoadProgram(const vector<word_t>& codebytes);
+    explicit Memory(const std::shared_ptr<const MemoryImage>& image);
+    Memory(const Memory& other);
+    Memory& operator=(const Memory& other);
+    ~Memory();
+
+    // Snapshots the content into an image then shares the image pages, the
+    // content itself is unchanged. Costs one copy however many memories are
+    // made from the image, a Fork itself only maps it.
+    std::shared_ptr<const MemoryImage> Freeze();
+    std::unique_ptr<Memory> Fork() { return std::make_unique<Memory>(Freeze()); }
+    // Replaces the content with the image, observers see the words they watch written
+    void LoadImage(const std::shared_ptr<const MemoryImage>& image);
+    // Zeroes the content in place, observers see the words they watch written
+    void Clear();
+
+    // returns the number of words loaded, up to the whole memory
+    long_t LoadProgram(const vector<word_t>& codebytes);
+    // little endian words from a binary file image, an odd last byte is the
+    // low byte of the last word. Returns the number of words loaded.
+    long_t LoadProgram(const byte_t* bytes, size_t byteCount);
+    // Replaces the content with the binary file at path, the words past it
+    // are zeroed. Where the memory is mapped and the host is little endian
+    // the file pages are mapped in place without copying (the host copies a
+    // page once it is written), the file must then not be changed while in
+    // use. Elsewhere same as LoadProgram on the file bytes.
+    bool MapProgram(const string& path, long_t& outWordCount);
     void Dump(word_t from=0, word_t to=LastValidAddress) const;
     void DumpNonNull() const;
 
     word_t* operator+(word_t addr) { return m_Buffer+addr; }
     word_t operator[](word_t addr) const { return m_Buffer[addr]; }
     word_t& operator[](word_t addr) { return m_Buffer[addr]; }
-    
+
+    // Writes going through raw pointers or operator[] are not seen by the
+    // observers, stores that may hit code should use Write or call Touch
+    // once the store is done.
+    void Write(word_t addr, word_t value) { m_Buffer[addr] = value; Touch(addr); }
+    void Touch(word_t addr) {
+#if DCPU_DIRTY_TRACKING
+        m_dirtyPages[addr / DirtyPageWords] = 1;
+#endif
+        if (IsWatched(addr)) NotifyWrite(addr);
+    }
+    void Touch(const word_t* ptr) {
+        if (ptr >= m_Buffer && ptr <= m_Buffer+LastValidAddress)
+            Touch(static_cast<word_t>(ptr - m_Buffer));
+    }
+
+    void Watch(word_t addr, word_t count=1);
+    bool IsWatched(word_t addr) const { return (m_watched[addr >> 6] >> (addr & 0x3F)) & 1; }
+
+#if DCPU_DIRTY_TRACKING
+    // Whether a page holding one of the count words from addr was written
+    // since it was last cleared. A fresh or copied memory starts clean, a
+    // loaded image or program marks what it replaced. Consumers clear the
+    // range they follow only, the pages are shared by all of them.
+    bool IsDirty(word_t addr, long_t count=1) const;
+    void ClearDirty(word_t addr, long_t count);
+    void ClearDirty() { std::memset(m_dirtyPages, 0, sizeof(m_dirtyPages)); }
+#endif
+
 private:
-    word_t m_Buffer[LastValidAddress+1];
+    friend class MemoryObserver;
+    friend class JitEngine;     // tests watched words and marks dirty pages from translated code
+    friend class Snapshot;      // saves the buffer as is
+    static constexpr word_t WatchBlockCount = (LastValidAddress+1) / 64;
+
+    void MapImage(const MemoryImage& image);
+    void TouchWatched();
+    void MarkDirty(long_t addr, long_t count);
+    void NotifyWrite(word_t addr);
+    void AddObserver(MemoryObserver* observer);
+    void RemoveObserver(MemoryObserver* observer);
+
+    word_t* m_Buffer = nullptr;         // LastValidAddress+1 words, host page aligned when mapped
+    bool m_isMapped = false;
+    uint64_t m_watched[WatchBlockCount];
+#if DCPU_DIRTY_TRACKING
+    byte_t m_dirtyPages[DirtyPageCount];    // a byte per page, translated code sets it with a plain store
+#endif
+    vector<MemoryObserver*> m_observers;
 };
@@ -0,0 +1,160 @@
+#include <dcpu-snapshot.h>
+#include <dcpu-hardware.h>
+#include <dcpu-mem.h>
+#include <dcpu.h>
+#include <cstdio>
+#include <fstream>
+#include <vector>
+
+using std::vector;
+
+namespace {
+    // magic, version, state item count, memory offset
+    constexpr size_t HeaderCount = 4;
+
+    struct StateReader {
+        const vector<uint32_t>& m_items;
+        size_t m_pos = HeaderCount;
+
+        bool has(size_t count) const { return m_pos + count <= m_items.size(); }
+        uint32_t next() { return m_items[m_pos++]; }
+    };
+}
+
+bool Snapshot::Save(const string& path, const DCPU& cpu, const Memory& mem) {
+    vector<uint32_t> items{Magic, Version, 0, 0};
+    items.insert(items.end(), {cpu.m_timing, cpu.m_cycles, static_cast<uint32_t>(cpu.m_instructionCount),
+                               static_cast<uint32_t>(cpu.m_instructionCount >> 32), cpu.m_pcLimit,
+                               cpu.m_pc, cpu.m_sp, cpu.m_ex, cpu.m_ia, cpu.m_idleCheckCycles});
+    items.insert(items.end(), cpu.m_registers, cpu.m_registers + Registers_Count);
+    items.insert(items.end(), {cpu.m_queueHead, cpu.m_queueSize, cpu.m_isInterruptQueueActive, cpu.m_isOnFire});
+    items.insert(items.end(), cpu.m_queuedInterrupts, cpu.m_queuedInterrupts + DCPU::InterruptQueueSize);
+
+    items.push_back(static_cast<uint32_t>(cpu.m_devices.size()));
+    vector<uint32_t> state;
+    for (const Hardware* device : cpu.m_devices) {
+        state.clear();
+        device->saveState(state);
+        items.insert(items.end(), {device->getId(), static_cast<uint32_t>(state.size())});
+        items.insert(items.end(), state.begin(), state.end());
+    }
+
+    const long_t stateBytes = static_cast<long_t>(items.size() * sizeof(uint32_t));
+    const long_t memoryOffset = (stateBytes + MemoryAlignment - 1) / MemoryAlignment * MemoryAlignment;
+    items[2] = static_cast<uint32_t>(items.size());
+    items[3] = memoryOffset;
+
+    // the memory may be mapped from the file being replaced (resuming then
+    // saving to the same path), it is written aside and renamed over it so
+    // the mapped file is never truncated under the memory
+    const string tempPath = path + ".tmp";
+    std::ofstream stream(tempPath, std::ios::binary | std::ios::trunc);
+    stream.write(reinterpret_cast<const char*>(items.data()), stateBytes);
+    stream.seekp(memoryOffset);
+    stream.write(reinterpret_cast<const char*>(mem.m_Buffer), Memory::TotalBytes);
+    stream.close();
+    if (!stream) {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        // hosts where rename does not replace an existing file
+        std::remove(path.c_str());
+        if (std::rename(tempPath.c_str(), path.c_str()) != 0) {
+            std::remove(tempPath.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Snapshot::Load(const string& path, DCPU& cpu, Memory& mem) {
+    std::ifstream stream(path, std::ios::binary);
+    vector<uint32_t> items(HeaderCount);
+    if (!stream.read(reinterpret_cast<char*>(items.data()), HeaderCount * sizeof(uint32_t)))
+        return false;
+    if (items[0] != Magic) {
+        printf("%s is not a snapshot of this host byte order\n", path.c_str());
+        return false;
+    }
+    if (items[1] != Version) {
+        printf("snapshot version %u is not supported (expected %u)\n", items[1], Version);
+        return false;
+    }
+    // the state items come before the memory which ends the file
+    stream.seekg(0, std::ios::end);
+    const uint64_t fileBytes = static_cast<uint64_t>(stream.tellg());
+    if (items[2] < HeaderCount || uint64_t{items[2]} * sizeof(uint32_t) > items[3]
+        || items[3] % MemoryAlignment != 0 || uint64_t{items[3]} + Memory::TotalBytes > fileBytes) {
+        printf("snapshot header is corrupt\n");
+        return false;
+    }
+    stream.seekg(HeaderCount * sizeof(uint32_t));
+    items.resize(items[2]);
+    stream.read(reinterpret_cast<char*>(items.data() + HeaderCount), (items.size() - HeaderCount) * sizeof(uint32_t));
+    if (!stream)
+        return false;
+
+    StateReader reader{items};
+    const size_t cpuCount = 10 + Registers_Count + 4 + DCPU::InterruptQueueSize + 1;
+    const size_t queueSizePos = HeaderCount + 10 + Registers_Count + 1;
+    if (!reader.has(cpuCount) || items[HeaderCount] > TimingMode_Functional
+        || items[queueSizePos] > DCPU::InterruptQueueSize)
+        return false;
+    reader.m_pos += cpuCount - 1;
+    if (reader.next() != cpu.m_devices.size()) {
+        printf("snapshot devices differ from the cpu ones\n");
+        return false;
+    }
+    vector<vector<uint32_t>> states(cpu.m_devices.size());
+    for (size_t i=0; i<states.size(); ++i) {
+        if (!reader.has(2) || reader.next() != cpu.m_devices[i]->getId()) {
+            printf("snapshot devices differ from the cpu ones\n");
+            return false;
+        }
+        const uint32_t count = reader.next();
+        if (!reader.has(count))
+            return false;
+        states[i].assign(items.begin() + reader.m_pos, items.begin() + reader.m_pos + count);
+        reader.m_pos += count;
+        if (!cpu.m_devices[i]->checkState(states[i]))
+            return false;
+    }
+    std::shared_ptr<const MemoryImage> image = MemoryImage::FromFile(path, items[3]);
+    if (image == nullptr)
+        return false;
+
+    // all of it fits, nothing is applied before this point
+    reader.m_pos = HeaderCount;
+    cpu.m_timing = static_cast<TimingMode>(reader.next());
+    cpu.m_cycles = reader.next();
+    cpu.m_instructionCount = reader.next();
+    cpu.m_instructionCount |= uint64_t{reader.next()} << 32;
+    cpu.m_pcLimit = reader.next();
+    cpu.m_pc = static_cast<word_t>(reader.next());
+    cpu.m_sp = static_cast<word_t>(reader.next());
+    cpu.m_ex = static_cast<word_t>(reader.next());
+    cpu.m_ia = static_cast<word_t>(reader.next());
+    cpu.m_idleCheckCycles = reader.next();
+    for (int r=0; r<Registers_Count; ++r) {
+        cpu.m_registers[r] = static_cast<word_t>(reader.next());
+    }
+    cpu.m_queueHead = static_cast<byte_t>(reader.next());
+    cpu.m_queueSize = static_cast<word_t>(reader.next());
+    const bool isQueueActive = reader.next() != 0;
+    cpu.m_isOnFire = reader.next() != 0;
+    for (word_t i=0; i<DCPU::InterruptQueueSize; ++i) {
+        cpu.m_queuedInterrupts[i] = static_cast<word_t>(reader.next());
+    }
+    cpu.setInterruptQueueActive(isQueueActive);
+
+    // devices announce their next event again from the loaded state
+    cpu.m_events = {};
+    for (deviceIdx_t i=0; i<cpu.m_devices.size(); ++i) {
+        cpu.m_devices[i]->loadState(cpu, states[i]);
+        cpu.m_deviceEvents[i] = Hardware::NoEvent;
+        cpu.scheduleDevice(i);
+    }
+    mem.LoadImage(image);
+    return true;
+}
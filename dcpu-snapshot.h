@@ -0,0 +1,26 @@
+#pragma once
+#include <dcpu-types.h>
+#include <cstdint>
+
+class DCPU;
+class Memory;
+
+//
+// Versioned machine snapshots. The file starts with the cpu state followed by
+// the state of each device, the memory words come last at an offset aligned
+// for mmap and in host byte order, so loading maps them back as a copy on
+// write image instead of reading them.
+//
+class Snapshot {
+public:
+    static constexpr uint32_t Magic = 0x53504344;           // "DCPS" on little endian hosts
+    static constexpr uint32_t Version = 2;
+    static constexpr long_t MemoryAlignment = 0x10000;      // the largest host page size around
+
+    // Interrupts posted from other threads and not received yet are not saved.
+    // The file is replaced whole, path may be the snapshot the memory was loaded from.
+    static bool Save(const string& path, const DCPU& cpu, const Memory& mem);
+    // The cpu needs the same kinds of devices attached, in the same order,
+    // false when the file does not fit it, the cpu, its devices and mem are then untouched
+    static bool Load(const string& path, DCPU& cpu, Memory& mem);
+};
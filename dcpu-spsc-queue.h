@@ -0,0 +1,51 @@
+#pragma once
+#include <dcpu-types.h>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+//
+// Bounded lock-free queue between exactly one producer thread and one
+// consumer thread. Each side owns its position and only reads the other's,
+// items are moved in and out of a fixed ring.
+//
+template<typename T, uint32_t Capacity>
+class SpscQueue {
+public:
+    SpscQueue() {}
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // producer side only, false when the queue is full
+    bool push(T&& item);
+    // consumer side only
+    bool isEmpty() const { return m_head.load(std::memory_order_relaxed) == m_tail.load(std::memory_order_acquire); }
+    bool pop(T& outItem);
+
+private:
+    static_assert((Capacity & (Capacity - 1)) == 0, "positions are masked with Capacity - 1");
+
+    alignas(64) std::atomic<uint32_t> m_head {0};    // next item to pop
+    alignas(64) std::atomic<uint32_t> m_tail {0};    // next item to push
+    T m_items[Capacity];
+};
+
+template<typename T, uint32_t Capacity>
+bool SpscQueue<T, Capacity>::push(T&& item) {
+    const uint32_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+        return false;
+    m_items[tail & (Capacity - 1)] = std::move(item);
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+template<typename T, uint32_t Capacity>
+bool SpscQueue<T, Capacity>::pop(T& outItem) {
+    const uint32_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail.load(std::memory_order_acquire))
+        return false;
+    outItem = std::move(m_items[head & (Capacity - 1)]);
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+}
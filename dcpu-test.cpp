@@ -1,10 +1,16 @@
 #include <cassert>
+#include <cstdarg>
 #include <cstdlib>
+#include <fstream>
+#include <dcpu-batch.h>
 #include <dcpu-codex.h>
+#include <dcpu-fleet.h>
 #include <dcpu-hardware-clock.h>
+#include <dcpu-hardware-monitor-headless.h>
 #include <dcpu-hardware-tester.h>
 #include <dcpu-lispasm.h>
 #include <dcpu-mem.h>
+#include <dcpu-snapshot.h>
 #include <dcpu-tokenizer.h>
 #include <dcpu.h>
 #include <sstream>
@@ -27,6 +33,8 @@
                                             snprintf(buf, sizeof buf, fmt, a, b); \
                                             return string(buf); });
 #define AddDevice(deviceType) t.AddDeviceFn([](DCPU& cpu, Memory& mem) { cpu.addDevice<deviceType>(); });
+#define RunInSlices(cycles) t.m_sliceCycles = cycles;
+#define Functional() t.m_timing = TimingMode_Functional;
 
 class TestCase {
 public:
@@ -40,7 +48,11 @@ public:
     vector<VerifyType> m_verifiers;
     vector<VerifyStrFnType> m_verifiersTxt;
     int m_id = 0;
+    cycles_t m_sliceCycles = 0;     // run through runFor with this budget instead of run
+    TimingMode m_timing = TimingMode_CycleAccurate;
     static int s_id;
+    static EngineType s_engine;
+    static bool s_usePeephole;
 
     TestCase(const char* name, string source)
         : m_testName(name)
@@ -60,43 +72,634 @@ public:
     bool TryTest() const;
 };
 int TestCase::s_id = 0;
+EngineType TestCase::s_engine = EngineType_Switch;
+bool TestCase::s_usePeephole = true;
 
-bool TestCase::TryTest() const {
-    std::basic_stringstream sourceStream{m_lasmSource};
+// Counts the checks of the tests written as functions and reports them the
+// way TestCase does, a line per failed check then the summary
+class TestReport {
+public:
+    const char* m_testName = nullptr;
+    int m_checkCount = 0;
+    int m_successCount = 0;
+
+    explicit TestReport(const char* name) : m_testName(name) {}
+
+    // details are printf formatted, printed when the check fails
+    bool Check(bool success, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+    bool CheckEqual(const char* what, uint32_t value, uint32_t expected) {
+        return Check(value == expected, "%s (0x%X) == 0x%X", what, value, expected);
+    }
+    bool Finish() const;
+};
+
+bool TestReport::Check(bool success, const char* fmt, ...) {
+    if (success) {
+        ++m_successCount;
+    } else {
+        printf("Test %s-%d [FAILURE] : ", m_testName, m_checkCount);
+        va_list args;
+        va_start(args, fmt);
+        vprintf(fmt, args);
+        va_end(args);
+        printf("\n");
+    }
+    ++m_checkCount;
+    return success;
+}
+
+bool TestReport::Finish() const {
+    const bool success = m_successCount == m_checkCount;
+    printf("Test %s %d/%d [%s]\n", m_testName, m_successCount, m_checkCount, success ? "SUCCESS" : "FAILURE");
+    return success;
+}
+
+vector<word_t> Assemble(const string& source) {
+    std::basic_stringstream sourceStream{source};
     vector<Token> tokens = Token::Tokenize(sourceStream);
     vector<SExp*> sexpressions = SExp::FromTokens(tokens);
-    vector<Instruction> instructions = LispAsmParser::FromSExpressions(sexpressions);
+    const vector<word_t> program = Codex::Encode(LispAsmParser::FromSExpressions(sexpressions));
     SExp::Delete(sexpressions);
-    vector<byte_t> codebytes = Codex::UnpackBytes(Codex::Encode(instructions));
+    return program;
+}
 
-    int test_success = 0;
-    DCPU cpu;
+bool TestCase::TryTest() const {
+    const vector<word_t> program = Assemble(m_lasmSource);
+
+    DCPU cpu{m_timing};
     Memory mem;
+    cpu.setPeepholeEnabled(s_usePeephole);
+    cpu.setEngine(s_engine);
     for (AddDeviceFnType deviceAdder : m_deviceAddFns) {
         deviceAdder(cpu, mem);
     }
- BeforeRun:
-    cpu.run(mem, codebytes);
-    for (int i=0; i < m_verifiers.size(); ++i) {
-        bool success = m_verifiers[i](cpu, mem);
-        if (!success) {
-        failedtest:
-            printf("Test %s-%d [FAILURE] : %s\n", m_testName, i, m_verifiersTxt[i](cpu, mem).c_str());
-        } else {
-            ++test_success;
+    if (m_sliceCycles == 0) {
+        cpu.run(mem, Codex::UnpackBytes(program));
+    } else {
+        cpu.setPCLimit(mem.LoadProgram(program));
+        while (cpu.runFor(mem, m_sliceCycles) != StopReason_PCLimit) {
+        }
+    }
+    TestReport report{m_testName};
+    for (size_t i=0; i < m_verifiers.size(); ++i) {
+        report.Check(m_verifiers[i](cpu, mem), "%s", m_verifiersTxt[i](cpu, mem).c_str());
+    }
+    return report.Finish();
+}
+
+// jobs differ by their initial registers, the last one never ends. Workers
+// reuse their machine, no job sees the memory, stack or devices of another.
+void TestFleet(TestReport& report) {
+    const vector<word_t> program = Assemble(
+        "(set y a)(hwn a)(set x a)(set a y)(add a b)(mul a 2)(set (ref 0x1000) a)(add (ref 0x1001) 1)(set push a)"
+        "(ife c 1)(sub pc 1)");
+
+    vector<FleetJob> jobs(64);
+    for (word_t i=0; i<jobs.size(); ++i) {
+        jobs[i].m_program = program;
+        jobs[i].m_registers[Registers_A] = i;
+        jobs[i].m_registers[Registers_B] = 1;
+        jobs[i].m_cycleBudget = 500;
+    }
+    jobs.back().m_registers[Registers_C] = 1;
+
+    FleetOptions options;
+    options.m_threadCount = 4;
+    options.m_engine = TestCase::s_engine;
+    options.m_captureAddr = 0x1000;
+    options.m_captureCount = 2;
+    options.m_setup = [](DCPU& cpu, Memory& mem) { cpu.addDevice<Clock>(); };
+    FleetRunner runner{options};
+    const vector<FleetResult> results = runner.run(jobs);
+
+    report.CheckEqual("job count", runner.getStats().m_jobCount, jobs.size());
+    for (word_t i=0; i<jobs.size(); ++i) {
+        const bool isLast = i + 1 == jobs.size();
+        const FleetResult& result = results[i];
+        report.Check(result.m_registers[Registers_A] == (i + 1) * 2 && result.m_memory[0] == (i + 1) * 2
+                     && result.m_memory[1] == 1 && result.m_sp == 0xFFFE && result.m_registers[Registers_X] == 1
+                     && result.m_stopReason == (isLast ? StopReason_Budget : StopReason_PCLimit)
+                     && (isLast || result.m_cycles == 18),
+                     "job %d: a %04X, mem %04X %04X, sp %04X, devices %d, stop reason %d, cycles %d",
+                     i, result.m_registers[Registers_A], result.m_memory[0], result.m_memory[1], result.m_sp,
+                     result.m_registers[Registers_X], result.m_stopReason, result.m_cycles);
+    }
+
+    // a program filling the whole memory keeps its pc limit past the last word
+    FleetJob wholeMemory;
+    wholeMemory.m_program.assign(Memory::LastValidAddress+1, Assemble("(add x 1)")[0]);
+    wholeMemory.m_cycleBudget = 100;
+    DCPU cpu;
+    Memory mem;
+    cpu.setEngine(TestCase::s_engine);
+    const FleetResult result = FleetRunner::RunJob(wholeMemory, FleetOptions{}, cpu, mem);
+    report.CheckEqual("whole memory pc limit", cpu.getPCLimit(), Memory::LastValidAddress+1);
+    report.CheckEqual("whole memory stop reason", result.m_stopReason, StopReason_Budget);
+    report.CheckEqual("whole memory x", result.m_registers[Registers_X], 50);
+}
+
+// machines differ by their initial registers, a register only loop runs in
+// lockstep then a collatz walk sends every lane its own way
+void TestBatch(TestReport& report) {
+    const vector<word_t> program = Assemble(
+        "(set push 0x1234)"
+        "(label sum)(add j a)(xor y j)(shl y 1)(adx z y)(add i 1)(ifl i 100)(set pc sum)"
+        "(label loop)(jsr step)(add c 1)(ifn a 1)(set pc loop)"
+        "(set (ref 0x1000) c)(set b pop)(set pc end)"
+        "(label step)(set x a)(and x 1)(ife x 0)(set pc even)(mul a 3)(add a 1)(set pc pop)"
+        "(label even)(shr a 1)(set pc pop)"
+        "(label end)");
+
+    for (cycles_t budget : {DCPU::NoCycleBudget, cycles_t{1500}}) {
+        const long_t machineCount = 40;
+        LockstepBatch batch{program, machineCount};
+        for (long_t i=0; i<machineCount; ++i) {
+            batch.getCPU(i).setRegister(Registers_A, i % 8 + 1);
+        }
+        batch.getCPU(3).addBreakpoint(0xFFFF);
+        const vector<StopReason> reasons = batch.run(budget);
+
+        for (long_t i=0; i<machineCount; ++i) {
+            DCPU cpu;
+            Memory mem;
+            cpu.setRegister(Registers_A, i % 8 + 1);
+            cpu.setPCLimit(mem.LoadProgram(program));
+            StopReason reason = StopReason_PCLimit;
+            do {
+                reason = cpu.runFor(mem, budget == DCPU::NoCycleBudget ? budget : budget - cpu.getCycles());
+            } while (reason == StopReason_Interrupt);
+
+            const DCPU& lane = batch.getCPU(i);
+            bool isSame = reasons[i] == reason && lane.getCycles() == cpu.getCycles()
+                && lane.getInstructionCount() == cpu.getInstructionCount() && lane.getPC() == cpu.getPC()
+                && lane.getSP() == cpu.getSP() && lane.getEX() == cpu.getEX()
+                && batch.getMemory(i)[0x1000] == mem[0x1000];
+            for (int r=0; r<Registers_Count; ++r) {
+                isSame = isSame && lane.getRegister(static_cast<Registers>(r)) == cpu.getRegister(static_cast<Registers>(r));
+            }
+            report.Check(isSame, "budget %u machine %u: cycles %u/%u, pc %04X/%04X, a %04X/%04X, c %04X/%04X",
+                         budget, i, lane.getCycles(), cpu.getCycles(), lane.getPC(), cpu.getPC(),
+                         lane.getRegister(Registers_A), cpu.getRegister(Registers_A),
+                         lane.getRegister(Registers_C), cpu.getRegister(Registers_C));
+        }
+        report.Check(batch.getStats().m_lockstepInstructions != 0, "budget %u: nothing ran in lockstep", budget);
+    }
+
+    // stores to data keep the decoded code, a store patching the code drops it
+    const vector<word_t> storing = Assemble(
+        "(label loop)(add (ref 0x1000) a)(set (ref i 0x2000) i)(add i 1)(ifl i 200)(set pc loop)"
+        "(label again)(label patch)(set x 1)(add j 1)(set c patch)(set (ref c) 0x8861)(ifn j 2)(set pc again)");
+    const long_t machineCount = 16;
+    LockstepBatch batch{storing, machineCount};
+    for (long_t i=0; i<machineCount; ++i) {
+        batch.getCPU(i).setRegister(Registers_A, i);
+    }
+    batch.run();
+    for (long_t i=0; i<machineCount; ++i) {
+        const DCPU& lane = batch.getCPU(i);
+        report.Check(lane.getRegister(Registers_X) == 2 && lane.getRegister(Registers_J) == 2
+                     && batch.getMemory(i)[0x1000] == static_cast<word_t>(i * 200) && batch.getMemory(i)[0x20C7] == 199,
+                     "storing machine %u: x %04X, j %04X, [0x1000] %04X", i, lane.getRegister(Registers_X),
+                     lane.getRegister(Registers_J), batch.getMemory(i)[0x1000]);
+    }
+    const BatchStats& stats = batch.getStats();
+    report.Check(stats.m_decodedCount < 30 && stats.m_divergedCount == 0,
+                 "storing: %zu instructions decoded, %zu machines diverged", stats.m_decodedCount, stats.m_divergedCount);
+}
+
+// a guest queueing interrupts without end sets the DCPU on fire, runs stop
+// there until it is reset
+void TestInterruptOverflow(TestReport& report) {
+    const vector<word_t> program = Assemble("(ias handler)(iaq 1)(label fill)(int 1)(add i 1)(set pc fill)"
+                                            "(label handler)(rfi 0)");
+
+    DCPU cpu;
+    Memory mem;
+    cpu.setEngine(TestCase::s_engine);
+    cpu.setPCLimit(mem.LoadProgram(program));
+    const StopReason reason = cpu.runFor(mem, DCPU::NoCycleBudget);
+    report.CheckEqual("stop reason", reason, StopReason_OnFire);
+    report.CheckEqual("on fire", cpu.isOnFire(), true);
+    report.CheckEqual("interrupts queued", cpu.getRegister(Registers_I) >= DCPU::InterruptQueueSize, true);
+
+    const cycles_t cycles = cpu.getCycles();
+    report.CheckEqual("stop reason again", cpu.runFor(mem, 100), StopReason_OnFire);
+    report.CheckEqual("cycles again", cpu.getCycles(), cycles);
+
+    cpu.reset();
+    cpu.setPCLimit(program.size());
+    report.CheckEqual("on fire once reset", cpu.isOnFire(), false);
+    report.CheckEqual("stop reason once reset", cpu.runFor(mem, 100), StopReason_Budget);
+}
+
+// forks share the parent pages until either side writes
+void TestMemoryFork(TestReport& report) {
+    const vector<word_t> program = Assemble("(label loop)(add (ref 0x8000) 1)(add i 1)(ifl i 100)(set pc loop)");
+
+    DCPU cpu;
+    Memory mem;
+    cpu.setEngine(TestCase::s_engine);
+    cpu.setPCLimit(mem.LoadProgram(program));
+    cpu.runFor(mem, 100);
+    const word_t count = mem[0x8000];
+
+    std::unique_ptr<Memory> fork = mem.Fork();
+    std::unique_ptr<Memory> other = std::make_unique<Memory>(mem.Freeze());
+    cpu.runFor(mem, DCPU::NoCycleBudget);
+    (*fork)[0x8000] = 0xBEEF;
+
+    report.CheckEqual("mem[0x8000]", mem[0x8000], 100);
+    report.CheckEqual("fork[0x8000]", (*fork)[0x8000], 0xBEEF);
+    report.CheckEqual("other[0x8000]", (*other)[0x8000], count);
+    report.CheckEqual("fork[0]", (*fork)[0], mem[0]);
+    report.CheckEqual("other[0x8001]", (*other)[0x8001], 0);
+}
+
+// a mapped program reads as the loaded one and writes stay out of the file
+void TestMapProgram(TestReport& report) {
+    const vector<word_t> program = Assemble("(set (ref 4000) 0xBEEF)(set (ref 0x8000) 1)");
+    const string path = "dcpu-test-program.tmp";
+
+    // spans a few pages and ends on a half word
+    vector<byte_t> bytes = Codex::UnpackBytes(program);
+    for (long_t i=bytes.size(); i<9001; ++i) {
+        bytes.push_back(static_cast<byte_t>(i * 7));
+    }
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    }
+
+    Memory loaded;
+    const long_t loadedCount = loaded.LoadProgram(bytes.data(), bytes.size());
+    Memory mem;
+    mem[0xF000] = 0x1234;
+    long_t wordCount = 0;
+    report.Check(mem.MapProgram(path, wordCount), "mapping %s", path.c_str());
+    report.CheckEqual("word count", wordCount, loadedCount);
+    report.CheckEqual("word count", wordCount, 4501);
+    long_t differing = 0;
+    for (long_t addr=0; addr<=Memory::LastValidAddress; ++addr) {
+        differing += mem[static_cast<word_t>(addr)] != loaded[static_cast<word_t>(addr)];
+    }
+    report.CheckEqual("differing words", differing, 0);
+
+    DCPU cpu;
+    cpu.setEngine(TestCase::s_engine);
+    cpu.setPCLimit(program.size());
+    cpu.runFor(mem, DCPU::NoCycleBudget);
+    Memory reloaded;
+    long_t reloadedCount = 0;
+    report.Check(reloaded.MapProgram(path, reloadedCount), "mapping %s again", path.c_str());
+    report.CheckEqual("mem[4000]", mem[4000], 0xBEEF);
+    report.CheckEqual("mem[0x8000]", mem[0x8000], 1);
+    report.CheckEqual("file word 4000", reloaded[4000], loaded[4000]);
+    report.Check(!reloaded.MapProgram("dcpu-test-missing.tmp", reloadedCount), "mapping a missing file");
+    std::remove(path.c_str());
+}
+
+// an async device answers at the same cycles however slow its worker is
+void TestAsyncDevice(TestReport& report) {
+    const vector<word_t> program = Assemble(
+        "(ias handler)"
+        "(set (ref 0x1000) 1)(set (ref 0x1001) 2)(set (ref 0x1002) 3)(set (ref 0x1003) 0xFFF0)"
+        "(set a 0)(set b 4)(set x 0x1000)(set y 0x2000)(hwi 0)"     // sum the 4 words into 0x2000
+        "(set a 1)(set b 300)(hwi 0)"                               // tick every 300 cycles
+        "(label wait)(ifl j 5)(set pc wait)"
+        "(set a 1)(set b 0)(hwi 0)"
+        "(set pc end)"
+        "(label handler)(ife a 1)(set i (ref 0x2000))(ife a 2)(add j 1)(rfi 0)"
+        "(label end)");
+
+    cycles_t cycles[2] = {};
+    word_t sums[2] = {};
+    word_t ticks[2] = {};
+    for (int run=0; run<2; ++run) {
+        DCPU cpu;
+        Memory mem;
+        cpu.setEngine(TestCase::s_engine);
+        cpu.addDevice<AsyncTesterDevice>()->setWorkerDelay(std::chrono::microseconds{run == 0 ? 0 : 2000});
+        cpu.setPCLimit(mem.LoadProgram(program));
+        while (cpu.runFor(mem, DCPU::NoCycleBudget) == StopReason_Interrupt) {
+        }
+        cycles[run] = cpu.getCycles();
+        sums[run] = cpu.getRegister(Registers_I);
+        ticks[run] = cpu.getRegister(Registers_J);
+    }
+
+    report.CheckEqual("sum", sums[0], 0xFFF6);
+    report.CheckEqual("ticks", ticks[0], 5);
+    report.CheckEqual("cycles", cycles[0], 1647);
+    report.CheckEqual("slow worker sum", sums[1], sums[0]);
+    report.CheckEqual("slow worker ticks", ticks[1], ticks[0]);
+    report.CheckEqual("slow worker cycles", cycles[1], cycles[0]);
+}
+
+// the headless monitor draws every frame, the same way on every run
+void TestMonitorCapture(TestReport& report) {
+    const vector<word_t> program = Assemble(
+        "(set a 0)(set b 0x8000)(hwi 0)"
+        "(set (ref 0x8000) 0xF041)"                 // 'A', palette 15 on palette 0
+        "(label wait)(add i 1)(ifl i 2000)(set pc wait)");
+    const string path = "dcpu-test-capture.tmp";
+    const string framePattern = "dcpu-test-capture-%03d.tmp";
+
+    vector<byte_t> framebuffers[3];
+    long_t frameCounts[3] = {};
+    for (int run=0; run<3; ++run) {
+        DCPU cpu;
+        Memory mem;
+        cpu.setEngine(TestCase::s_engine);
+        Monitor* monitor = cpu.addDevice<Monitor>();
+        std::unique_ptr<HeadlessDisplay> display = run == 0
+            ? std::make_unique<HeadlessDisplay>()
+            : std::make_unique<HeadlessDisplay>(run == 1 ? path : framePattern, CaptureFormat_PPM);
+        HeadlessDisplay* headless = display.get();
+        monitor->setDisplay(std::move(display));
+        cpu.setPCLimit(mem.LoadProgram(program));
+        cpu.runFor(mem, DCPU::NoCycleBudget);
+        framebuffers[run].assign(headless->getFramebuffer(), headless->getFramebuffer() + HeadlessDisplay::FramebufferBytes);
+        frameCounts[run] = headless->getFrameCount();
+        monitor->setDisplay(nullptr);   // flushes the capture
+    }
+    std::ifstream capture(path, std::ios::binary | std::ios::ate);
+    const long_t captureBytes = capture ? static_cast<long_t>(capture.tellg()) : 0;
+    capture.close();
+    std::remove(path.c_str());
+    long_t frameFileCount = 0;
+    for (long_t i=0; i<frameCounts[2]; ++i) {
+        char framePath[64];
+        snprintf(framePath, sizeof(framePath), "dcpu-test-capture-%03u.tmp", i);
+        std::ifstream frame(framePath, std::ios::binary | std::ios::ate);
+        frameFileCount += frame && frame.tellg() == 14 + Monitor::Width * Monitor::Height * 3;
+        frame.close();
+        std::remove(framePath);
+    }
+
+    auto pixel = [&framebuffers](long_t x, long_t y) {
+        const byte_t* rgba = framebuffers[0].data() + (x + y*Monitor::Width) * 4;
+        return uint32_t{rgba[0]} << 24 | rgba[1] << 16 | rgba[2] << 8 | rgba[3];
+    };
+    report.CheckEqual("frames", frameCounts[0] >= 4, true);
+    report.CheckEqual("same frames", frameCounts[1], frameCounts[0]);
+    report.CheckEqual("same pixels", framebuffers[0] == framebuffers[1], true);
+    report.CheckEqual("'A' background", pixel(0, 0), 0xFFFFFFFF);
+    report.CheckEqual("'A' foreground", pixel(0, 1), 0x770077FF);
+    report.CheckEqual("empty cell", pixel(4, 1), 0x000000FF);
+    report.CheckEqual("capture", captureBytes, frameCounts[1] * (14 + Monitor::Width * Monitor::Height * 3));
+    report.CheckEqual("frame files", frameFileCount, frameCounts[0]);
+    // the pattern only takes a %d, it is never handed to printf
+    report.CheckEqual("%s pattern", HeadlessDisplay{"frame-%s.ppm", CaptureFormat_PPM}.isCapturing(), false);
+    report.CheckEqual("%999d pattern", HeadlessDisplay{"frame-%999d.ppm", CaptureFormat_PPM}.isCapturing(), false);
+    report.CheckEqual("%d%n pattern", HeadlessDisplay{"frame-%d%n.ppm", CaptureFormat_PPM}.isCapturing(), false);
+}
+
+// fonts and palettes dumped then mapped back, changing the palette recolors the screen
+void TestMonitorMapped(TestReport& report) {
+    const vector<word_t> program = Assemble(
+        "(set a 4)(set b 0x9000)(hwi 0)(set a 5)(set b 0x9100)(hwi 0)"
+        "(set (ref 0x9082) 0xFFFF)(set (ref 0x9083) 0xFFFF)"        // 'A' is a full block
+        "(set (ref 0x910F) 0x0F00)"                                 // palette 15 is red
+        "(set a 1)(set b 0x9000)(hwi 0)(set a 2)(set b 0x9100)(hwi 0)"
+        "(set a 0)(set b 0x8000)(hwi 0)(set (ref 0x8000) 0xF041)"
+        "(label wait)(add i 1)(ifl i 1000)(set pc wait)"
+        "(set (ref 0x910F) 0x00F0)"                                 // then green
+        "(label wait2)(add i 1)(ifl i 2000)(set pc wait2)");
+
+    DCPU cpu;
+    Memory mem;
+    cpu.setEngine(TestCase::s_engine);
+    Monitor* monitor = cpu.addDevice<Monitor>();
+    std::unique_ptr<HeadlessDisplay> display = std::make_unique<HeadlessDisplay>();
+    HeadlessDisplay* headless = display.get();
+    monitor->setDisplay(std::move(display));
+    cpu.setPCLimit(mem.LoadProgram(program));
+
+    auto pixel = [headless](long_t x, long_t y) {
+        const byte_t* rgba = headless->getFramebuffer() + (x + y*Monitor::Width) * 4;
+        return uint32_t{rgba[0]} << 24 | rgba[1] << 16 | rgba[2] << 8 | rgba[3];
+    };
+    cpu.runFor(mem, 3000);
+    report.CheckEqual("font[1]", mem[0x9001], 0x388E);
+    report.CheckEqual("font[255]", mem[0x90FF], 0x0200);
+    report.CheckEqual("palette[0]", mem[0x9100], 0x0FFF);
+    report.CheckEqual("palette[14]", mem[0x910E], 0x0077);
+    report.CheckEqual("red block", pixel(0, 0), 0xFF0000FF);
+    report.CheckEqual("red block bottom", pixel(3, 7), 0xFF0000FF);
+    cpu.runFor(mem, DCPU::NoCycleBudget);
+    report.CheckEqual("green block", pixel(0, 0), 0x00FF00FF);
+    report.CheckEqual("empty cell", pixel(4, 0), 0x000000FF);
+}
+
+#if DCPU_DIRTY_TRACKING
+// guest writes mark their page on every engine, clearing a range leaves the others
+void TestDirtyPages(TestReport& report) {
+    const vector<word_t> program = Assemble(
+        "(set i 0)(label loop)(set (ref 0x8000) i)(add i 1)(ifl i 200)(set pc loop)"
+        "(sti (ref 0x9041) 1)(set sp 0x1000)(set push 5)");
+
+    DCPU cpu;
+    Memory mem;
+    cpu.setEngine(TestCase::s_engine);
+    cpu.setPCLimit(mem.LoadProgram(program));
+    report.CheckEqual("program dirty", mem.IsDirty(0, program.size()), true);
+    cpu.runFor(mem, 500);     // the loop is hot by then
+    mem.ClearDirty();
+    cpu.runFor(mem, DCPU::NoCycleBudget);
+    report.CheckEqual("0x8000 dirty", mem.IsDirty(0x8000), true);
+    report.CheckEqual("0x803F dirty", mem.IsDirty(0x803F), true);
+    report.CheckEqual("0x8040 dirty", mem.IsDirty(0x8040), false);
+    report.CheckEqual("0x9041 dirty", mem.IsDirty(0x9041), true);
+    report.CheckEqual("0x0FFF dirty", mem.IsDirty(0x0FFF), true);
+    report.CheckEqual("0x7FC0..0x8FFF dirty", mem.IsDirty(0x8040, 0xFC0) || mem.IsDirty(0x7FC0, 0x40), false);
+    mem.ClearDirty(0x8000, 1);
+    report.CheckEqual("0x8000 dirty once cleared", mem.IsDirty(0x8000), false);
+    report.CheckEqual("0x9040 dirty", mem.IsDirty(0x9040), true);
+    report.CheckEqual("copy dirty", Memory{mem}.IsDirty(0, Memory::LastValidAddress+1), false);
+}
+#endif
+
+// a loop whose failed conditionals skip long IF chains, instructions cost
+// far more cycles on average than a plain one
+vector<word_t> EncodeIfChainLoop(const string& prologue, const string& epilogue) {
+    string chain;
+    for (int i=0; i<19; ++i) {
+        chain += "(ife (ref 0x3000) 0x1234)";
+    }
+    return Assemble(prologue
+        + "(label loop)(ife a 0x100)" + chain + "(add j 1)"
+        + "(add i 1)(ife b 0x200)" + chain + "(add j 1)"
+        + "(ifl i 2000)(set pc loop)" + epilogue);
+}
+
+// runFor stops on the same instruction with every engine, whatever the
+// cycles of the instructions in the batch
+void TestBudgetStops(TestReport& report) {
+    const vector<word_t> program = EncodeIfChainLoop("", "");
+    const cycles_t slices[] = {5, 17, 40, 113, 1000};
+    vector<uint64_t> stops[2];
+    const EngineType engines[2] = {EngineType_Switch, TestCase::s_engine};
+    for (int run=0; run<2; ++run) {
+        DCPU cpu;
+        Memory mem;
+        cpu.setEngine(engines[run]);
+        cpu.setPeepholeEnabled(TestCase::s_usePeephole);
+        cpu.setPCLimit(mem.LoadProgram(program));
+        for (size_t i=0; cpu.runFor(mem, slices[i % 5]) != StopReason_PCLimit; ++i) {
+            stops[run].push_back(uint64_t{cpu.getCycles()} << 16 | cpu.getPC());
+        }
+        stops[run].push_back(cpu.getCycles());
+    }
+
+    report.CheckEqual("stops", stops[1].size(), stops[0].size());
+    for (size_t i=0; i<std::min(stops[0].size(), stops[1].size()); ++i) {
+        if (!report.Check(stops[0][i] == stops[1][i], "stop %zu, cycles %u pc %04X instead of cycles %u pc %04X",
+                          i, static_cast<uint32_t>(stops[1][i] >> 16), static_cast<uint32_t>(stops[1][i] & 0xFFFF),
+                          static_cast<uint32_t>(stops[0][i] >> 16), static_cast<uint32_t>(stops[0][i] & 0xFFFF)))
+            break;
+    }
+}
+
+// clock ticks due in the middle of IF chain skips are delivered after the
+// same instruction with every engine
+void TestDeviceEvents(TestReport& report) {
+    const vector<word_t> program = EncodeIfChainLoop(
+        "(ias handler)(set a 0)(set b 1)(hwi 0)(set a 2)(set b 7)(hwi 0)(set a 0)(set b 0)",
+        "(set pc end)(label handler)(set (ref x 0x4000) (ref sp 1))(add x 1)(rfi 0)(label end)");
+    vector<word_t> returnPCs[2];
+    cycles_t cycles[2] = {};
+    const EngineType engines[2] = {EngineType_Switch, TestCase::s_engine};
+    for (int run=0; run<2; ++run) {
+        DCPU cpu;
+        Memory mem;
+        cpu.setEngine(engines[run]);
+        cpu.setPeepholeEnabled(TestCase::s_usePeephole);
+        cpu.addDevice<Clock>();
+        cpu.setPCLimit(mem.LoadProgram(program));
+        while (cpu.runFor(mem, DCPU::NoCycleBudget) == StopReason_Interrupt) {
         }
+        returnPCs[run].assign(mem + 0x4000, mem + 0x4000 + cpu.getRegister(Registers_X));
+        cycles[run] = cpu.getCycles();
     }
-    printf("Test %s %d/%d [%s]\n", m_testName, test_success, m_verifiers.size(),
-           test_success == m_verifiers.size() ? "SUCCESS" : "FAILURE");
 
-    return test_success == m_verifiers.size();
+    report.CheckEqual("many ticks", returnPCs[0].size() > 10, true);
+    report.CheckEqual("ticks", returnPCs[1].size(), returnPCs[0].size());
+    report.CheckEqual("cycles", cycles[1], cycles[0]);
+    for (size_t i=0; i<std::min(returnPCs[0].size(), returnPCs[1].size()); ++i) {
+        if (!report.Check(returnPCs[0][i] == returnPCs[1][i], "tick %zu returned to %04X instead of %04X",
+                          i, returnPCs[1][i], returnPCs[0][i]))
+            break;
+    }
+}
+
+// a machine loaded from a snapshot taken midway ends like the original
+void TestSnapshot(TestReport& report) {
+    const vector<word_t> program = Assemble(
+        "(ias handler)(iaq 1)(int 7)(int 9)"
+        "(set a 0)(set b 1)(hwi 0)(set a 2)(hwi 0)(iaq 0)"    // saved with two interrupts queued
+        "(label wait)(ifl x 6)(set pc wait)"
+        "(set a 1)(hwi 0)(set pc end)"
+        "(label handler)(add x 1)(add (ref 0x2000) a)(rfi 0)"
+        "(label end)");
+    const string path = "dcpu-test-snapshot.tmp";
+
+    DCPU cpu;
+    Memory mem;
+    cpu.setEngine(TestCase::s_engine);
+    cpu.addDevice<Clock>();
+    cpu.setPCLimit(mem.LoadProgram(program));
+    cpu.runFor(mem, 20);
+    report.Check(Snapshot::Save(path, cpu, mem), "saving %s", path.c_str());
+    while (cpu.runFor(mem, DCPU::NoCycleBudget) == StopReason_Interrupt) {
+    }
+
+    DCPU loaded;
+    Memory loadedMem;
+    loaded.setEngine(TestCase::s_engine);
+    loaded.addDevice<Clock>();
+    const bool isLoaded = report.Check(Snapshot::Load(path, loaded, loadedMem), "loading %s", path.c_str());
+    while (isLoaded && loaded.runFor(loadedMem, DCPU::NoCycleBudget) == StopReason_Interrupt) {
+    }
+    report.CheckEqual("cycles", loaded.getCycles(), cpu.getCycles());
+    report.CheckEqual("instructions", loaded.getInstructionCount(), cpu.getInstructionCount());
+    report.CheckEqual("pc", loaded.getPC(), cpu.getPC());
+    report.CheckEqual("sp", loaded.getSP(), cpu.getSP());
+    report.CheckEqual("ia", loaded.getIA(), cpu.getIA());
+    report.CheckEqual("x", loaded.getRegister(Registers_X), cpu.getRegister(Registers_X));
+    report.CheckEqual("c", loaded.getRegister(Registers_C), cpu.getRegister(Registers_C));
+    report.CheckEqual("[0x2000]", loadedMem[0x2000], mem[0x2000]);
+    report.CheckEqual("[0x2000] written", mem[0x2000] != 0, true);
+
+    // saved again over the file its memory is mapped from
+    report.Check(Snapshot::Save(path, loaded, loadedMem), "saving %s over its own mapping", path.c_str());
+    DCPU resumed;
+    Memory resumedMem;
+    resumed.addDevice<Clock>();
+    report.Check(Snapshot::Load(path, resumed, resumedMem), "loading %s again", path.c_str());
+    report.CheckEqual("resumed cycles", resumed.getCycles(), loaded.getCycles());
+    report.CheckEqual("resumed [0x2000]", resumedMem[0x2000], loadedMem[0x2000]);
+
+    DCPU other;
+    other.addDevice<TesterDevice>();
+    report.Check(!Snapshot::Load(path, other, loadedMem), "loading with other devices");
+
+    // a state item count running past the memory
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        const uint32_t itemCount = 0xFFFFFFFF;
+        file.seekp(2 * sizeof(uint32_t));
+        file.write(reinterpret_cast<const char*>(&itemCount), sizeof(itemCount));
+    }
+    DCPU corrupt;
+    corrupt.addDevice<Clock>();
+    report.Check(!Snapshot::Load(path, corrupt, loadedMem), "loading a corrupt header");
+
+    // the second clock state does not fit, the first clock keeps its own
+    {
+        DCPU twoClocks;
+        Memory twoClocksMem;
+        twoClocks.addDevice<Clock>();
+        twoClocks.addDevice<Clock>();
+        twoClocks.setPCLimit(twoClocksMem.LoadProgram(program));
+        twoClocks.runFor(twoClocksMem, 20);
+        Snapshot::Save(path, twoClocks, twoClocksMem);
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        uint32_t itemCount = 0;
+        file.seekg(2 * sizeof(uint32_t));
+        file.read(reinterpret_cast<char*>(&itemCount), sizeof(itemCount));
+        const uint32_t timeMode = 0xFF;
+        file.seekp((itemCount - 5) * sizeof(uint32_t));
+        file.write(reinterpret_cast<const char*>(&timeMode), sizeof(timeMode));
+    }
+    DCPU untouched;
+    Memory untouchedMem;
+    const Clock* first = untouched.addDevice<Clock>();
+    untouched.addDevice<Clock>();
+    vector<uint32_t> before;
+    first->saveState(before);
+    report.Check(!Snapshot::Load(path, untouched, untouchedMem), "loading a device state that does not fit");
+    vector<uint32_t> after;
+    first->saveState(after);
+    report.Check(after == before, "first clock state overwritten by a failed load");
+    report.CheckEqual("untouched cycles", untouched.getCycles(), 0);
+    std::remove(path.c_str());
 }
 
 int main(int argc, char** argv) {
     const char* singleTestName = nullptr;
     bool shouldStop = false;
-    if (argc > 1) {
-        singleTestName = argv[1];
+    for (int i=1; i<argc; ++i) {
+        if (std::strcmp(argv[i], "--engine") == 0 && i+1 < argc) {
+            TestCase::s_engine = StrToEngineType(argv[++i]);
+            if (TestCase::s_engine == EngineType_Count) {
+                printf("unknown engine: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--no-peephole") == 0) {
+            TestCase::s_usePeephole = false;
+        } else {
+            singleTestName = argv[i];
+        }
     }
     
     CreateTestCase("Basic", "(set X 12)\n", VerifyEqual(cpu.getRegister(Registers_X), 12));
@@ -279,10 +882,45 @@ int main(int argc, char** argv) {
                    VerifyEqual(cpu.getRegister(Registers_X), 8);
                    VerifyEqual(cpu.getRegister(Registers_Y), 0)
                    VerifyEqual(cpu.getRegister(Registers_I), 0x78)
-                   VerifyEqual(cpu.getEX(), 0xE000)
+                   VerifyEqual(cpu.getEX(), 0)
                    VerifyEqual(cpu.getCycles(), 7)
                    );
 
+    // looped so that engines translating hot code run it translated too
+    CreateTestCase("Shift Counts",
+                   "(label again)"
+                   "(set x 0x8001)(shr x 16)(set (ref 0x1000) ex)"
+                   "(set y 0x8001)(shr y 31)(set (ref 0x1001) ex)"
+                   "(set z 0x8001)(shr z 32)(set (ref 0x1002) ex)"
+                   "(set i 0x8001)(asr i 31)(set (ref 0x1003) ex)"
+                   "(set j 0x8001)(asr j 0xFFFF)(set (ref 0x1004) ex)"
+                   "(set a 0x8001)(shl a 16)(set (ref 0x1005) ex)"
+                   "(set b 0x8001)(shl b 31)(set (ref 0x1006) ex)"
+                   "(set c 0x8001)(shl c 32)(set (ref 0x1007) ex)"
+                   "(set (ref 0x2000) 0x8001)(shl (ref 0x2000) 0xFFFF)(set (ref 0x1008) ex)"
+                   "(add (ref 0x3000) 1)(ifl (ref 0x3000) 40)(set pc again)"
+                   ,
+                   VerifyEqual(cpu.getRegister(Registers_X), 0)
+                   VerifyEqual(mem[0x1000], 0x8001)
+                   VerifyEqual(cpu.getRegister(Registers_Y), 0)
+                   VerifyEqual(mem[0x1001], 1)
+                   VerifyEqual(cpu.getRegister(Registers_Z), 0)
+                   VerifyEqual(mem[0x1002], 0)
+                   VerifyEqual(cpu.getRegister(Registers_I), 0xFFFF)
+                   VerifyEqual(mem[0x1003], 1)
+                   VerifyEqual(cpu.getRegister(Registers_J), 0xFFFF)
+                   VerifyEqual(mem[0x1004], 0)
+                   VerifyEqual(cpu.getRegister(Registers_A), 0)
+                   VerifyEqual(mem[0x1005], 0x8001)
+                   VerifyEqual(cpu.getRegister(Registers_B), 0)
+                   VerifyEqual(mem[0x1006], 0x8000)
+                   VerifyEqual(cpu.getRegister(Registers_C), 0)
+                   VerifyEqual(mem[0x1007], 0)
+                   VerifyEqual(mem[0x2000], 0)
+                   VerifyEqual(mem[0x1008], 0)
+                   VerifyEqual(mem[0x3000], 40)
+                   );
+
     CreateTestCase("IFB",
                    "(set x 1)"
                    "(set y 2)"
@@ -462,6 +1100,79 @@ int main(int argc, char** argv) {
                    VerifyEqual(cpu.getCycles(), 16)
                    );
 
+    CreateTestCase("IfLoop",
+                   "(set x 0)"
+                   "(label loop)"
+                   "(add x 1)"
+                   "(ifg x 3)"
+                   "(ifl x 6)"
+                   "(add y 1)"
+                   "(ifn x 8)"
+                   "(set pc loop)"
+                   ,
+                   VerifyEqual(cpu.getRegister(Registers_X), 8)
+                   VerifyEqual(cpu.getRegister(Registers_Y), 2)
+                   VerifyEqual(cpu.getCycles(), 87)
+                   );
+
+    CreateTestCase("IfLoop Sliced",
+                   "(set x 0)"
+                   "(label loop)"
+                   "(add x 1)"
+                   "(ifg x 3)"
+                   "(ifl x 6)"
+                   "(add y 1)"
+                   "(ifn x 8)"
+                   "(set pc loop)"
+                   ,
+                   RunInSlices(5);
+                   VerifyEqual(cpu.getRegister(Registers_X), 8)
+                   VerifyEqual(cpu.getRegister(Registers_Y), 2)
+                   VerifyEqual(cpu.getCycles(), 87)
+                   );
+
+    CreateTestCase("Peephole",
+                   "(set i 0)"
+                   "(label loop)"
+                   "(set a 3)"
+                   "(set b a)"
+                   "(set a 0x1000)"
+                   "(add (ref a) b)"      // reads a through a propagated literal
+                   "(shl a 4)"           // ex overwritten below
+                   "(add c 0xFFFF)"
+                   "(set x ex)"
+                   "(set (ref 0x1001) pc)"
+                   "(add i 1)"
+                   "(ifn i 5)"
+                   "(set pc loop)"
+                   "(set y a)"
+                   ,
+                   VerifyEqual(mem[0x1000], 15)
+                   VerifyEqual(mem[0x1001], 9)
+                   VerifyEqual(cpu.getRegister(Registers_B), 3)
+                   VerifyEqual(cpu.getRegister(Registers_C), 0xFFFB)
+                   VerifyEqual(cpu.getRegister(Registers_X), 1)
+                   VerifyEqual(cpu.getRegister(Registers_Y), 0)
+                   VerifyEqual(cpu.getEX(), 0)
+                   VerifyEqual(cpu.getCycles(), 91)
+                   );
+
+    CreateTestCase("IfLoop Functional",
+                   "(set x 0)"
+                   "(label loop)"
+                   "(add x 1)"
+                   "(ifg x 3)"
+                   "(ifl x 6)"
+                   "(add y 1)"
+                   "(ifn x 8)"
+                   "(set pc loop)"
+                   ,
+                   Functional();
+                   VerifyEqual(cpu.getRegister(Registers_X), 8)
+                   VerifyEqual(cpu.getRegister(Registers_Y), 2)
+                   VerifyEqual(cpu.getCycles(), 39)
+                   );
+
     CreateTestCase("ADX",
                    "(set i 0xFFFF)"
                    "(adx i 2)"
@@ -634,6 +1345,85 @@ int main(int argc, char** argv) {
                    VerifyEqual(cpu.getCycles(), 36)
                    );
 
+    CreateTestCase("Interrupt Queue Wrap",
+                   "(ias handler)"
+                   "(label outer)"
+                   "(iaq 1)"
+                   "(set i 0)"
+                   "(label fill)"
+                   "(int 1)"
+                   "(add i 1)"
+                   "(ifn i 200)"
+                   "(set pc fill)"
+                   "(iaq 0)"    // 200 queued, the second pass wraps the ring
+                   "(add j 1)"
+                   "(ifn j 2)"
+                   "(set pc outer)"
+                   "(set pc done)"
+                   "(label handler)"
+                   "(add x 1)"
+                   "(rfi 0)"
+                   "(label done)"
+                   ,
+                   VerifyEqual(cpu.getRegister(Registers_X), 400)
+                   VerifyEqual(cpu.getRegister(Registers_J), 2)
+                   VerifyEqual(cpu.getCycles(), 6423)
+                   );
+
+    CreateTestCase("Self Modifying Code",
+                   "(set j 0)"
+                   "(label loop)"
+                   "(label patch)"
+                   "(set x 1)"
+                   "(add j 1)"
+                   "(set i patch)"
+                   "(set (ref i) 0x8861)" // (set x 2)
+                   "(ifn j 2)"
+                   "(set pc loop)"
+                   ,
+                   VerifyEqual(cpu.getRegister(Registers_X), 2)
+                   VerifyEqual(cpu.getRegister(Registers_J), 2)
+                   VerifyEqual(cpu.getCycles(), 22)
+                   );
+
+    CreateTestCase("Self Modifying Skipped Code",
+                   "(set i patch)"
+                   "(label loop)"
+                   "(ifn j j)"
+                   "(label patch)"
+                   "(set x 1)"
+                   "(add y 1)"             // becomes the literal of the patched set
+                   "(set (ref i) 0x7C61)" // (set x next-literal)
+                   "(add j 1)"
+                   "(ifn j 2)"
+                   "(set pc loop)"
+                   ,
+                   VerifyEqual(cpu.getRegister(Registers_X), 0)
+                   VerifyEqual(cpu.getRegister(Registers_Y), 1)
+                   VerifyEqual(cpu.getRegister(Registers_J), 2)
+                   VerifyEqual(cpu.getCycles(), 25)
+                   );
+
+    CreateTestCase("Hot Self Modifying Loop",
+                   "(set i patch)"
+                   "(label loop)"
+                   "(label patch)"
+                   "(add z 1)"
+                   "(add j 1)"
+                   "(set push j)"
+                   "(add x pop)"
+                   "(ife j 60)"
+                   "(set (ref i) 0x88A2)" // (add z 2)
+                   "(ifn j 100)"
+                   "(set pc loop)"
+                   ,
+                   VerifyEqual(cpu.getRegister(Registers_Z), 140)
+                   VerifyEqual(cpu.getRegister(Registers_J), 100)
+                   VerifyEqual(cpu.getRegister(Registers_X), 5050)
+                   VerifyEqual(cpu.getSP(), 0xFFFF)
+                   VerifyEqual(cpu.getCycles(), 1602)
+                   );
+
     CreateTestCase("HWN",
                    "(hwn a)"
                    ,
@@ -656,6 +1446,108 @@ int main(int argc, char** argv) {
                    VerifyEqual(cpu.getCycles(), 4)
                    );
 
+    CreateTestCase("Idle Loop",
+                   "(ias handler)"
+                   "(set a 0)"
+                   "(set b 1)"
+                   "(hwi 0)"    // tick at 60 Hz
+                   "(set a 2)"
+                   "(hwi 0)"    // with interrupts
+                   "(label wait)"
+                   "(ifl x 3)"
+                   "(set pc wait)"
+                   "(set a 0)"
+                   "(set b 0)"
+                   "(hwi 0)"
+                   "(set pc done)"
+                   "(label handler)"
+                   "(add x 1)"
+                   "(rfi 0)"
+                   "(label done)"
+                   ,
+                   AddDevice(Clock);
+                   VerifyEqual(cpu.getRegister(Registers_X), 3)
+                   VerifyEqual(cpu.getCycles(), 5022)
+                   );
+
+    CreateTestCase("Idle Loop Wall Clock",
+                   "(ias handler)"
+                   "(set a 0)"
+                   "(set b 1)"
+                   "(hwi 0)"    // tick at 60 Hz
+                   "(set a 2)"
+                   "(hwi 0)"    // with interrupts
+                   "(label wait)"
+                   "(ifl x 3)"
+                   "(set pc wait)"
+                   "(set a 0)"
+                   "(set b 0)"
+                   "(hwi 0)"
+                   "(set pc done)"
+                   "(label handler)"
+                   "(add x 1)"
+                   "(rfi 0)"
+                   "(label done)"
+                   ,
+                   t.AddDeviceFn([](DCPU& cpu, Memory& mem) { cpu.addDevice<Clock>()->setTimeMode(ClockTime_Wall); });
+                   VerifyEqual(cpu.getRegister(Registers_X), 3)
+                   Verify(cpu.getCycles() < 20000) // each wait fast-forwarded, not spun
+                   );
+
+    CreateTestCase("Clock Ticks",
+                   "(set a 0)"
+                   "(set b 2)"
+                   "(hwi 0)"    // tick at 30 Hz, every 3333.3 cycles
+                   "(set i 0)"
+                   "(label loop)"
+                   "(add i 1)"
+                   "(ifn i 2000)"
+                   "(set pc loop)"
+                   "(set a 1)"
+                   "(hwi 0)"
+                   ,
+                   AddDevice(Clock);
+                   VerifyEqual(cpu.getRegister(Registers_C), 4)
+                   VerifyEqual(cpu.getCycles(), 14013)
+                   );
+
+    CreateTestCase("Device Event",
+                   "(ias handler)"
+                   "(set a 2)"
+                   "(set b 1000)"
+                   "(hwi 0)"    // TesterDevice interrupts 1000 cycles later
+                   "(label wait)"
+                   "(ife x 0)"
+                   "(set pc wait)"
+                   "(set pc done)"
+                   "(label handler)"
+                   "(set x 1)"
+                   "(rfi 0)"
+                   "(label done)"
+                   ,
+                   AddDevice(TesterDevice);
+                   VerifyEqual(cpu.getRegister(Registers_X), 1)
+                   VerifyEqual(cpu.getCycles(), 1014)
+                   );
+
+    CreateTestCase("Posted Interrupts",
+                   "(ias handler)"
+                   "(set a 3)"
+                   "(set b 100)"
+                   "(hwi 0)"    // TesterDevice posts 100 interrupts from its own thread
+                   "(label wait)"
+                   "(ifn x 100)"
+                   "(set pc wait)"
+                   "(set pc done)"
+                   "(label handler)"
+                   "(add x 1)"
+                   "(rfi 0)"
+                   "(label done)"
+                   ,
+                   AddDevice(TesterDevice);
+                   VerifyEqual(cpu.getRegister(Registers_X), 100)
+                   );
+
     CreateTestCase("HWI",
                    "(set i 11)"
                    "(set a 0)"
@@ -677,6 +1569,47 @@ int main(int argc, char** argv) {
                    VerifyEqual(cpu.getCycles(), 29)
                    );
 
+    CreateTestCase("HWI Functional",
+                   "(set i 11)"
+                   "(set a 0)"
+                   "(hwi 0)"    // x should be set to 10 by TesterDevice
+                   "(mul i x)"
+                   ,
+                   AddDevice(TesterDevice);
+                   Functional();
+                   VerifyEqual(cpu.getRegister(Registers_I), 110)
+                   VerifyEqual(cpu.getCycles(), 4)
+                   );
+
+    // tests written as functions, run by the name they report with
+    struct NamedTest {
+        const char* m_name;
+        void (*m_run)(TestReport& report);
+    };
+    const NamedTest namedTests[] = {
+        {"Budget Stops", TestBudgetStops},
+        {"Device Events", TestDeviceEvents},
+        {"Fleet", TestFleet},
+        {"Batch", TestBatch},
+        {"Interrupt Overflow", TestInterruptOverflow},
+        {"Memory Fork", TestMemoryFork},
+        {"Map Program", TestMapProgram},
+        {"Snapshot", TestSnapshot},
+        {"Async Device", TestAsyncDevice},
+        {"Monitor Capture", TestMonitorCapture},
+        {"Monitor Mapped", TestMonitorMapped},
+#if DCPU_DIRTY_TRACKING
+        {"Dirty Pages", TestDirtyPages},
+#endif
+    };
+    for (const NamedTest& test : namedTests) {
+        if (shouldStop || (singleTestName != nullptr && std::strcmp(singleTestName, test.m_name) != 0))
+            continue;
+        TestReport report{test.m_name};
+        test.m_run(report);
+        shouldStop = !report.Finish();
+    }
+
     if (!shouldStop) {
         printf("All Tests Completed Successfully\n");
         return 0;
@@ -113,6 +113,7 @@ struct Instruction
     Instruction();
     Instruction(OpCode op, Value b, Value a, word_t wordB=0, word_t wordA=0);
     byte_t WordCount() const;
+    cycles_t BaseCycles() const;
     string toStr() const;
 };
 
@@ -159,6 +160,87 @@ inline byte_t Instruction::WordCount() const {
     }
 }
 
+// cycles spent by the instruction itself, without the skipped instructions of a
+// failed IF nor the cycles charged by a device on HWI. 0 for unknown opcodes.
+inline cycles_t Instruction::BaseCycles() const {
+    cycles_t cycles = 0;
+    switch (m_opcode) {
+    case OpCode_Special:
+        switch (static_cast<word_t>(m_b)) {
+        case SpecialOpCode_JSR: cycles = 3; break;
+        case SpecialOpCode_INT: cycles = 4; break;
+        case SpecialOpCode_IAG: cycles = 1; break;
+        case SpecialOpCode_IAS: cycles = 1; break;
+        case SpecialOpCode_RFI: cycles = 3; break;
+        case SpecialOpCode_IAQ: cycles = 2; break;
+        case SpecialOpCode_HWN: cycles = 2; break;
+        case SpecialOpCode_HWQ: cycles = 4; break;
+        case SpecialOpCode_HWI: cycles = 4; break;
+        default: return 0;
+        }
+        return cycles + (isMultibyteValue(m_a) ? 1 : 0);
+    case OpCode_SET:
+    case OpCode_AND:
+    case OpCode_BOR:
+    case OpCode_XOR:
+    case OpCode_SHR:
+    case OpCode_ASR:
+    case OpCode_SHL:
+        cycles = 1;
+        break;
+    case OpCode_ADD:
+    case OpCode_SUB:
+    case OpCode_MUL:
+    case OpCode_MLI:
+    case OpCode_IFB:
+    case OpCode_IFC:
+    case OpCode_IFE:
+    case OpCode_IFN:
+    case OpCode_IFG:
+    case OpCode_IFA:
+    case OpCode_IFL:
+    case OpCode_IFU:
+    case OpCode_STI:
+    case OpCode_STD:
+        cycles = 2;
+        break;
+    case OpCode_DIV:
+    case OpCode_DVI:
+    case OpCode_MOD:
+    case OpCode_MDI:
+    case OpCode_ADX:
+    case OpCode_SBX:
+        cycles = 3;
+        break;
+    default:
+        return 0;
+    }
+    return cycles + (isMultibyteValue(m_a) ? 1 : 0) + (isMultibyteValue(m_b) ? 1 : 0);
+}
+
+// Shift counts are the whole 16 bit a: counts of 16 to 31 still leave bits
+// in EX, 32 and more move every bit out of both b and EX (ASR fills b with
+// the sign). C++ shifts by 32 or more are undefined, counts are clamped to 32
+// and shifts done on 64 bits.
+inline word_t ShiftCount(word_t count) {
+    return std::min<word_t>(count, 32);
+}
+
+constexpr bool isConditionalOpCode(OpCode op) {
+    return op >= OpCode_IFB && op <= OpCode_IFU;
+}
+
+// opcodes always setting EX, without reading it first
+constexpr bool overwritesEX(OpCode op) {
+    switch (op) {
+    case OpCode_ADD: case OpCode_SUB: case OpCode_MUL: case OpCode_MLI: case OpCode_DIV:
+    case OpCode_DVI: case OpCode_SHR: case OpCode_ASR: case OpCode_SHL:
+        return true;
+    default:
+        return false;
+    }
+}
+
 inline string NumToHexStr(word_t w) {
     std::stringstream stream;
     stream << "0x" << std::hex << w;
@@ -3,9 +3,14 @@
 #include <cassert>
 #include <dcpu-mem.h>
 #include <dcpu-hardware.h>
+#include <dcpu-engine-block.h>
+#include <dcpu-engine-jit.h>
+#include <dcpu-engine-specialized.h>
+#include <dcpu-engine-threaded.h>
 
-DCPU::DCPU()
-    : m_pc {0}
+DCPU::DCPU(TimingMode timing)
+    : m_timing {timing}
+    , m_pc {0}
     , m_sp {Memory::LastValidAddress}
     , m_ex {0}
     , m_ia {0}
@@ -13,6 +18,40 @@ DCPU::DCPU()
     memset(&m_registers, 0, Registers_Count*2);
 }
 
+DCPU::~DCPU() {
+    for (Hardware* device : m_devices) {
+        delete device;
+    }
+}
+
+void DCPU::reset() {
+    for (Hardware* device : m_devices) {
+        delete device;
+    }
+    m_devices.clear();
+    m_deviceEvents.clear();
+    m_events = {};
+    m_cycles = 0;
+    m_instructionCount = 0;
+    m_pc = 0;
+    m_sp = Memory::LastValidAddress;
+    m_ex = 0;
+    m_ia = 0;
+    memset(&m_registers, 0, Registers_Count*2);
+    m_pcLimit = NoPCLimit;
+    m_idleCheckCycles = 0;
+    m_queueHead = 0;
+    m_queueSize = 0;
+    m_isInterruptQueueActive = false;
+    m_isInterruptPending = false;
+    m_isOnFire = false;
+    word_t message = 0;
+    while (m_postedInterrupts.receive(message)) {
+    }
+    m_breakpoints.clear();
+    m_breakpointCount = 0;
+}
+
 word_t* DCPU::getAddrPtr(Memory& mem, bool isA, Value v, word_t& extraWord, cycles_t& inOutCycles) {
     const word_t numV = static_cast<word_t>(v);
     if (isA && numV >= 0x20) {
@@ -100,6 +139,15 @@ word_t GetNextCodeAddressSkipIF(Memory& mem, word_t pc, word_t& outSkippedInstru
 }
 
 
+cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
+    if (m_timing == TimingMode_Functional)
+        return eval<TimingMode_Functional>(mem, inst);
+    return eval<TimingMode_CycleAccurate>(mem, inst);
+}
+
+// The cycle count is only used by the cycle accurate instantiation, in
+// functional mode it is dead code and 1 is returned per instruction.
+template<TimingMode Mode>
 cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
     //printf("evaluating mem[0x%04X]: %s\n", m_pc, inst.toStr().c_str());
     cycles_t cycles = 0;
@@ -114,8 +162,8 @@ cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
         switch (specialOp) {
         case SpecialOpCode_JSR: {
             cycles += 3;
-            const word_t nextPC = GetNextCodeAddress(mem, m_pc);
-            *(mem + (--m_sp)) = nextPC;
+            const word_t nextPC = m_pc + inst.WordCount();
+            push(mem, nextPC);
             m_pc = *a_addr;
             break;
         }
@@ -123,12 +171,12 @@ cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
             cycles += 4;
             if (m_ia != 0) {
                 if (m_isInterruptQueueActive) {
-                    m_queuedInterrupts.push(*a_addr);
+                    queueInterrupt(*a_addr);
                 } else {
-                    m_isInterruptQueueActive = true;
-                    const word_t nextPC = GetNextCodeAddress(mem, m_pc);
-                    *(mem + (--m_sp)) = nextPC;
-                    *(mem + (--m_sp)) = m_registers[Registers_A];;
+                    setInterruptQueueActive(true);
+                    const word_t nextPC = m_pc + inst.WordCount();
+                    push(mem, nextPC);
+                    push(mem, m_registers[Registers_A]);
                     m_pc = m_ia;
                     m_registers[Registers_A] = *a_addr;
                 }
@@ -138,6 +186,7 @@ cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
         case SpecialOpCode_IAG: {
             cycles += 1;
             *a_addr = m_ia;
+            mem.Touch(a_addr);
             break;
         }
         case SpecialOpCode_IAS: {
@@ -148,14 +197,14 @@ cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
         case SpecialOpCode_RFI: {
             SpecialOpCode_RFI:
             cycles += 3;
-            m_isInterruptQueueActive = false;
+            setInterruptQueueActive(false);
             m_registers[Registers_A] = *(mem + (m_sp++));
             m_pc = *(mem + (m_sp++));
             break;
         }
         case SpecialOpCode_IAQ: {
             cycles += 2;
-            m_isInterruptQueueActive = *a_addr != 0;
+            setInterruptQueueActive(*a_addr != 0);
             break;
         }
         case SpecialOpCode_HWN: {
@@ -187,9 +236,13 @@ cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
             dcpu_assert_fmt(m_devices[deviceIndex] != nullptr, "device index %d was nullptr", deviceIndex);
 
             const cycles_t intCycles = m_devices[deviceIndex]->interrupt(*this, mem);
+            scheduleDevice(deviceIndex);
             cycles += 4 + intCycles;
             break;
         }
+        default:
+            dcpu_assert_fmt(false, "Unknown special opcode for instruction %s", inst.toStr().c_str());
+            break;
         }
         break;
     }
@@ -289,32 +342,30 @@ cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
     case OpCode_SHR: {
         cycles += 1;
         const word_t b = *b_addr;
-        *b_addr = b >> *a_addr;
-        m_ex = ((static_cast<long_t>(b)<<16) >> *a_addr) & 0xFFFF;
+        *b_addr = static_cast<word_t>(static_cast<uint64_t>(b) >> ShiftCount(*a_addr));
+        m_ex = ((static_cast<uint64_t>(b)<<16) >> ShiftCount(*a_addr)) & 0xFFFF;
         break;
     }
     case OpCode_ASR: {
         cycles += 1;
         OpCode_ASR:
         const word_t b = *b_addr;
-        *b_addr = static_cast<word_t>(static_cast<signed_word_t>(b) >> *a_addr);
-        m_ex = ((static_cast<long_t>(b)<<16) >> *a_addr) & 0xFFFF;
+        *b_addr = static_cast<word_t>(static_cast<int64_t>(static_cast<signed_word_t>(b)) >> ShiftCount(*a_addr));
+        m_ex = ((static_cast<uint64_t>(b)<<16) >> ShiftCount(*a_addr)) & 0xFFFF;
         break;
     }
     case OpCode_SHL:{
         cycles += 1;
         const word_t b = *b_addr;
-        *b_addr = b << *a_addr;
-        m_ex = ((static_cast<long_t>(b)<<16) >> *a_addr) & 0xFFFF;
+        *b_addr = static_cast<word_t>(static_cast<uint64_t>(b) << ShiftCount(*a_addr));
+        m_ex = ((static_cast<uint64_t>(b) << ShiftCount(*a_addr)) >> 16) & 0xFFFF;
         break;
     }
     case OpCode_IFB: {
         OpCode_IFB:
         if ((*b_addr & *a_addr) == 0) {
             word_t skippedCount = 0;
-            word_t nextPC = GetNextCodeAddress(mem, m_pc);
-            nextPC = GetNextCodeAddressSkipIF(mem, nextPC, skippedCount);
-            m_pc = nextPC;
+            m_pc = getSkipTarget(mem, skippedCount);
             cycles += 2 + skippedCount;
         } else {
             cycles += 2;
@@ -324,9 +375,7 @@ cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
     case OpCode_IFC: {
         if ((*b_addr & *a_addr) != 0) {
             word_t skippedCount = 0;
-            word_t nextPC = GetNextCodeAddress(mem, m_pc);
-            nextPC = GetNextCodeAddressSkipIF(mem, nextPC, skippedCount);
-            m_pc = nextPC;
+            m_pc = getSkipTarget(mem, skippedCount);
             cycles += 2 + skippedCount;
         } else {
             cycles += 2;
@@ -336,9 +385,7 @@ cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
     case OpCode_IFE: {
         if (*b_addr != *a_addr) {
             word_t skippedCount = 0;
-            word_t nextPC = GetNextCodeAddress(mem, m_pc);
-            nextPC = GetNextCodeAddressSkipIF(mem, nextPC, skippedCount);
-            m_pc = nextPC;
+            m_pc = getSkipTarget(mem, skippedCount);
             cycles += 2 + skippedCount;
         } else {
             cycles += 2;
@@ -349,9 +396,7 @@ cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
         test:
         if (*b_addr == *a_addr) {
             word_t skippedCount = 0;
-            word_t nextPC = GetNextCodeAddress(mem, m_pc);
-            nextPC = GetNextCodeAddressSkipIF(mem, nextPC, skippedCount);
-            m_pc = nextPC;
+            m_pc = getSkipTarget(mem, skippedCount);
             cycles += 2 + skippedCount;
         } else {
             cycles += 2;
@@ -361,9 +406,7 @@ cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
     case OpCode_IFG: {
         if (*b_addr <= *a_addr) {
             word_t skippedCount = 0;
-            word_t nextPC = GetNextCodeAddress(mem, m_pc);
-            nextPC = GetNextCodeAddressSkipIF(mem, nextPC, skippedCount);
-            m_pc = nextPC;
+            m_pc = getSkipTarget(mem, skippedCount);
             cycles += 2 + skippedCount;
         } else {
             cycles += 2;
@@ -373,9 +416,7 @@ cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
     case OpCode_IFA: {
         if (static_cast<signed_word_t>(*b_addr) <= static_cast<signed_word_t>(*a_addr)) {
             word_t skippedCount = 0;
-            word_t nextPC = GetNextCodeAddress(mem, m_pc);
-            nextPC = GetNextCodeAddressSkipIF(mem, nextPC, skippedCount);
-            m_pc = nextPC;
+            m_pc = getSkipTarget(mem, skippedCount);
             cycles += 2 + skippedCount;
         } else {
             cycles += 2;
@@ -385,9 +426,7 @@ cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
     case OpCode_IFL: {
         if (*b_addr >= *a_addr) {
             word_t skippedCount = 0;
-            word_t nextPC = GetNextCodeAddress(mem, m_pc);
-            nextPC = GetNextCodeAddressSkipIF(mem, nextPC, skippedCount);
-            m_pc = nextPC;
+            m_pc = getSkipTarget(mem, skippedCount);
             cycles += 2 + skippedCount;
         } else {
             cycles += 2;
@@ -397,9 +436,7 @@ cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
     case OpCode_IFU: {
         if (static_cast<signed_word_t>(*b_addr) >= static_cast<signed_word_t>(*a_addr)) {
             word_t skippedCount = 0;
-            word_t nextPC = GetNextCodeAddress(mem, m_pc);
-            nextPC = GetNextCodeAddressSkipIF(mem, nextPC, skippedCount);
-            m_pc = nextPC;
+            m_pc = getSkipTarget(mem, skippedCount);
             cycles += 2 + skippedCount;
         } else {
             cycles += 2;
@@ -440,53 +477,289 @@ cycles_t DCPU::eval(Memory& mem, Instruction& inst) {
         assert(false);
     }
     static_assert(OpCode_Count == 0x20, "Please update this when changing opcodes");
-    dcpu_assert_fmt(cycles != 0, "Cycle count was not set for instruction %s", inst.toStr().c_str());
+    if (!isSpecialOp && !isConditionalOpCode(inst.m_opcode)) {
+        mem.Touch(b_addr);
+    }
+    if constexpr (Mode == TimingMode_Functional) {
+        return 1;
+    } else {
+        dcpu_assert_fmt(cycles != 0, "Cycle count was not set for instruction %s", inst.toStr().c_str());
+        return cycles;
+    }
+}
 
-    return cycles;
+// pc after a failed conditional at the pc, including the chained ones it skips
+word_t DCPU::getSkipTarget(Memory& mem, word_t& outSkippedCount) {
+    if (m_useDecodeCache) {
+        const DecodedInstruction& entry = m_decodeCache.fetchSkip(mem, m_pc);
+        outSkippedCount = entry.m_skipCount;
+        return entry.m_skipTarget;
+    }
+    const word_t nextPC = GetNextCodeAddress(mem, m_pc);
+    return GetNextCodeAddressSkipIF(mem, nextPC, outSkippedCount);
 }
 
-void DCPU::step(Memory& mem) {
-    word_t* codebytePtr = mem+m_pc;
-    Instruction nextInstruction = Codex::Decode(codebytePtr, mem.LastValidAddress-m_pc);
+void DCPU::push(Memory& mem, word_t value) {
+    mem.Write(--m_sp, value);
+}
+
+void DCPU::interpret(Memory& mem) {
+    Instruction nextInstruction = m_useDecodeCache
+        ? m_decodeCache.fetch(mem, m_pc).m_instruction
+        : Codex::Decode(mem+m_pc, mem.LastValidAddress-m_pc);
     const word_t originalPC = m_pc;
     const cycles_t cycles = eval(mem, nextInstruction);
     if (m_pc == originalPC)
         m_pc += nextInstruction.WordCount(); // only increment if it wasn't changed
     m_cycles += cycles;
+}
 
-    for (Hardware* device : m_devices) {
-        m_cycles += device->update(*this, mem);
-    }
+void DCPU::step(Memory& mem) {
+    advance(mem, 1, NoCycleBudget);
+}
+
+// Runs up to maxInstructions, stopping after the one that brings the cycles
+// spent to maxCycles. Returns true if a queued interrupt was delivered.
+bool DCPU::advance(Memory& mem, long_t maxInstructions, cycles_t maxCycles) {
+    // queued interrupts are checked after every instruction
+    const long_t count = m_queueSize == 0 ? maxInstructions : 1;
+    if (m_engine != nullptr) {
+        m_instructionCount += runEngine(mem, count, maxCycles);
+    } else {
+        const cycles_t startCycles = m_cycles;
+        long_t executed = 0;
+        bool isSpecialOp = false;
+        do {
+            // like the engines, end the batch on INT, HWI and friends
+            isSpecialOp = (mem[m_pc] & 0x1F) == OpCode_Special;
+            interpret(mem);
+            ++executed;
+        } while (!isSpecialOp && executed < count && m_cycles - startCycles < maxCycles && m_pc < m_pcLimit);
+        m_instructionCount += executed;
+    }
+    updateDevices(mem);
+    if (m_postedInterrupts.hasMessage()) {
+        receivePostedInterrupts();
+    }
+    return processInterrupts(mem);
+}
+
+long_t DCPU::runEngine(Memory& mem, long_t maxInstructions, cycles_t maxCycles) {
+    if (m_timing == TimingMode_CycleAccurate) {
+        return m_engine->execute(*this, mem, maxInstructions, maxCycles);
+    }
+    // engines charge their static costs anyway, only instructions are reported
+    // and each one counts for a cycle
+    const cycles_t cycles = m_cycles;
+    const long_t executed = m_engine->execute(*this, mem, std::min<long_t>(maxInstructions, maxCycles),
+                                              NoCycleBudget);
+    m_cycles = cycles + executed;
+    return executed;
+}
 
-    if (!m_isInterruptQueueActive && !m_queuedInterrupts.empty()) {
-        const word_t intMsg = m_queuedInterrupts.front();
-        m_queuedInterrupts.pop();
-        m_isInterruptQueueActive = true;
-        *(mem + (--m_sp)) = m_pc;
-        *(mem + (--m_sp)) = m_registers[Registers_A];;
+bool DCPU::processInterrupts(Memory& mem) {
+    if (m_isInterruptPending) {
+        const word_t intMsg = m_queuedInterrupts[m_queueHead++];
+        --m_queueSize;
+        setInterruptQueueActive(true);
+        push(mem, m_pc);
+        push(mem, m_registers[Registers_A]);
         m_pc = m_ia;
         m_registers[Registers_A] = intMsg;
+        return true;
     }
+    return false;
 }
 
-cycles_t DCPU::run(Memory& mem, const vector<byte_t>& codebytes) {
-    const word_t lastProgramAddr = mem.LoadProgram(Codex::PackBytes(codebytes));
-    cycles_t stepCount = 0;
-    while(m_pc < lastProgramAddr) {
-        step(mem);
+void DCPU::attachDevice(Hardware* device) {
+    device->init(m_devices.size());
+    m_devices.push_back(device);
+    m_deviceEvents.push_back(Hardware::NoEvent);
+    scheduleDevice(m_devices.size() - 1);
+}
+
+void DCPU::scheduleDevice(deviceIdx_t deviceIndex) {
+    const cycles_t cycle = m_devices[deviceIndex]->nextEvent(*this);
+    if (cycle == m_deviceEvents[deviceIndex])
+        return;
+    m_deviceEvents[deviceIndex] = cycle;
+    if (cycle != Hardware::NoEvent) {
+        m_events.push({cycle, deviceIndex});
+    }
+}
+
+// Calls the devices whose event is due, each then schedules its next one
+void DCPU::updateDevices(Memory& mem) {
+    while (!m_events.empty() && static_cast<int32_t>(m_cycles - m_events.top().m_cycle) >= 0) {
+        const ScheduledEvent event = m_events.top();
+        m_events.pop();
+        if (m_deviceEvents[event.m_device] != event.m_cycle)
+            continue; // rescheduled since
+        m_deviceEvents[event.m_device] = Hardware::NoEvent;
+
+        const cycles_t deviceCycles = m_devices[event.m_device]->update(*this, mem);
+        if (m_timing == TimingMode_CycleAccurate) {
+            m_cycles += deviceCycles;
+        }
+        scheduleDevice(event.m_device);
+    }
+}
+
+// stale entries only make it earlier than needed
+cycles_t DCPU::cyclesUntilNextEvent() const {
+    if (m_events.empty())
+        return Hardware::NoEvent;
+    const int32_t remaining = static_cast<int32_t>(m_events.top().m_cycle - m_cycles);
+    return remaining > 0 ? remaining : 0;
+}
+
+// Fast-forwards whole iterations of an idle loop starting at the pc, staying
+// below maxCycles (the next device event or the end of the budget). The
+// instruction reaching it is executed, so the event is seen after the same
+// instruction as without skipping.
+bool DCPU::skipIdleLoop(Memory& mem, cycles_t maxCycles) {
+    if (maxCycles == 0 || maxCycles == Hardware::NoEvent || m_cycles - m_idleCheckCycles < IdleCheckCycles
+        || m_queueSize != 0 || m_postedInterrupts.hasMessage())
+        return false;
+    m_idleCheckCycles = m_cycles;
+
+    cycles_t loopCycles = 0;
+    if (!findIdleLoop(mem, loopCycles))
+        return false;
+
+    const cycles_t skipped = (maxCycles - 1) / loopCycles * loopCycles;
+    if (skipped == 0)
+        return false;
+
+    m_cycles += skipped;
+    m_idleCheckCycles = m_cycles;
+    for (Hardware* device : m_devices) {
+        device->onIdle(skipped);
+    }
+    return true;
+}
+
+// An idle loop is made of conditionals and jumps whose operands have no side
+// effects, so only an interrupt can change where it goes. It is run once to
+// find its cycles, which leaves no trace besides the pc it started from.
+bool DCPU::findIdleLoop(Memory& mem, cycles_t& outCycles) {
+    const word_t startPC = m_pc;
+    const cycles_t startCycles = m_cycles;
+    bool isLoop = false;
+    for (long_t count = 1; count <= MaxIdleLoopInstructions && m_pc < m_pcLimit; ++count) {
+        const Instruction inst = m_useDecodeCache
+            ? m_decodeCache.fetch(mem, m_pc).m_instruction
+            : Codex::Decode(mem+m_pc, mem.LastValidAddress-m_pc);
+        const bool isBranch = isConditionalOpCode(inst.m_opcode)
+            || (inst.m_opcode == OpCode_SET && inst.m_b == Value_PC);
+        if (!isBranch || inst.m_a == Value_PushPop || inst.m_b == Value_PushPop)
+            break;
+
+        interpret(mem);
+        if (m_pc == startPC) {
+            isLoop = true;
+            break;
+        }
     }
-    dcpu_assert_fmt(m_queuedInterrupts.empty(), "Did not process all interrupts, queue: %d, queue active? %d",
-                    m_queuedInterrupts.size(), m_isInterruptQueueActive);
+    outCycles = m_cycles - startCycles;
+    m_pc = startPC;
+    m_cycles = startCycles;
+    return isLoop;
+}
+
+StopReason DCPU::runFor(Memory& mem, cycles_t budget) {
+    auto never = [](const DCPU&) { return false; };
+    return runLoop(mem, budget, false, never);
+}
+
+cycles_t DCPU::run(Memory& mem, const vector<byte_t>& codebytes) {
+    const long_t lastProgramAddr = mem.LoadProgram(codebytes.data(), codebytes.size());
+    m_pcLimit = lastProgramAddr;
+    StopReason reason = StopReason_Interrupt;
+    while (reason != StopReason_PCLimit && reason != StopReason_OnFire) {
+        reason = runFor(mem, NoCycleBudget);
+    }
+    m_pcLimit = NoPCLimit;
+    dcpu_assert_fmt(m_queueSize == 0 || m_isOnFire, "Did not process all interrupts, queue: %d, queue active? %d",
+                    m_queueSize, m_isInterruptQueueActive);
 
     return m_cycles;
 }
 
+void DCPU::addBreakpoint(word_t addr) {
+    if (m_breakpoints.empty()) {
+        m_breakpoints.resize(0x10000, false);
+    }
+    if (!m_breakpoints[addr]) {
+        m_breakpoints[addr] = true;
+        ++m_breakpointCount;
+    }
+}
+
+void DCPU::removeBreakpoint(word_t addr) {
+    if (!m_breakpoints.empty() && m_breakpoints[addr]) {
+        m_breakpoints[addr] = false;
+        --m_breakpointCount;
+    }
+}
+
+void DCPU::setEngine(EngineType type) {
+    m_engineType = type;
+    switch (type) {
+    case EngineType_Threaded: m_engine = std::make_unique<ThreadedEngine>(); break;
+    case EngineType_Specialized: m_engine = std::make_unique<SpecializedEngine>(); break;
+    case EngineType_Block: m_engine = std::make_unique<BlockEngine>(); break;
+    case EngineType_Jit: m_engine = std::make_unique<JitEngine>(); break;
+    default:
+        dcpu_assert_fmt(type == EngineType_Switch, "unknown engine type: %d", type);
+        m_engineType = EngineType_Switch;
+        m_engine.reset();
+        break;
+    }
+    if (m_engine != nullptr) {
+        m_engine->setPeepholeEnabled(m_usePeephole);
+    }
+}
+
+void DCPU::setPeepholeEnabled(bool enabled) {
+    m_usePeephole = enabled;
+    if (m_engine != nullptr) {
+        m_engine->setPeepholeEnabled(enabled);
+    }
+}
+
 void DCPU::interrupt(word_t message){
     if (m_ia != 0) {
-        m_queuedInterrupts.push(message);
+        queueInterrupt(message);
+    }
+}
+
+// Past InterruptQueueSize the DCPU catches fire: the interrupt is dropped and
+// runs stop with StopReason_OnFire once the current batch of instructions ends.
+// Guest code can get there, so it is not an assert.
+void DCPU::queueInterrupt(word_t message) {
+    static_assert(InterruptQueueSize == 0x100, "m_queueHead wraps at the queue size");
+    if (m_queueSize == InterruptQueueSize) {
+        m_isOnFire = true;
+        return;
+    }
+    m_queuedInterrupts[static_cast<byte_t>(m_queueHead + m_queueSize)] = message;
+    ++m_queueSize;
+    m_isInterruptPending = !m_isInterruptQueueActive;
+}
+
+void DCPU::receivePostedInterrupts() {
+    word_t message = 0;
+    while (m_postedInterrupts.receive(message)) {
+        interrupt(message);
     }
 }
 
+void DCPU::setInterruptQueueActive(bool active) {
+    m_isInterruptQueueActive = active;
+    m_isInterruptPending = !active && m_queueSize != 0;
+}
+
 void DCPU::printRegisters() const {
     printf("pc: %04X\n", m_pc);
     printf("sp: %04X\n", m_sp);
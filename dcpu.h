@@ -1,11 +1,14 @@
 #pragma once
 
 #include <dcpu-assert.h>
+#include <dcpu-decode-cache.h>
+#include <dcpu-engine.h>
+#include <dcpu-interrupt-channel.h>
+#include <memory>
 #include <vector>
 #include <queue>
 #include <dcpu-types.h>
 using std::vector;
-using std::queue;
 
 class Instruction;
 class Hardware;
@@ -23,48 +26,209 @@ enum Registers : word_t {
     Registers_Count,
 };
 
+enum TimingMode {
+    TimingMode_CycleAccurate,   // cycles charged as per the specification
+    TimingMode_Functional,      // no cycle accounting, getCycles() counts instructions
+};
+
+enum StopReason {
+    StopReason_PCLimit,       // pc reached the pc limit
+    StopReason_Budget,        // the cycle budget was used up
+    StopReason_Interrupt,     // a queued interrupt was delivered
+    StopReason_Breakpoint,    // pc reached a breakpoint
+    StopReason_Predicate,     // the runUntil predicate returned true
+    StopReason_OnFire,        // the interrupt queue overflowed, stays stopped until reset
+};
+
 class DCPU {
 public:
-    DCPU();
+    static constexpr long_t NoPCLimit = 0x10000;
+    static constexpr long_t RunBatchSize = 4096;
+    static constexpr cycles_t NoCycleBudget = 0xFFFFFFFF;
+    static constexpr cycles_t CyclesPerSecond = 100000;      // nominal 100 kHz
+    static constexpr cycles_t IdleCheckCycles = 64;           // cycles between idle loop checks
+    static constexpr long_t MaxIdleLoopInstructions = 8;
+    static constexpr word_t InterruptQueueSize = 256;       // the DCPU catches fire past that
+
+    explicit DCPU(TimingMode timing = TimingMode_CycleAccurate);
+    DCPU(const DCPU&) = delete;
+    DCPU& operator=(const DCPU&) = delete;
+    ~DCPU();
     cycles_t run(Memory& mem, const vector<byte_t>& codebytes);
     void step(Memory& mem);
+    // Back to the state of a new DCPU, the devices and breakpoints are removed.
+    // The timing, engine and caches are kept, the caches follow the writes of
+    // the memory they run on so a reused Memory needs no more than Clear.
+    void reset();
+
+    // Runs until the budget is used up (checked between instructions, so the
+    // last one may go past it, in functional mode it counts instructions) or
+    // one of the other StopReasons happens. A run starting on a breakpoint
+    // executes it. runUntil evaluates the predicate after every instruction
+    // and so never runs engine batches. Batches end at the next device event,
+    // runFor fast-forwards idle loops (see skipIdleLoop) up to there or to the
+    // end of the budget.
+    StopReason runFor(Memory& mem, cycles_t budget);
+    template<typename Predicate> StopReason runUntil(Memory& mem, Predicate predicate,
+                                                     cycles_t budget = NoCycleBudget);
     void interrupt(word_t message);
+    // Same as interrupt but safe from any thread (devices or host code running
+    // on their own), the message is picked up between instructions. Returns
+    // false when too many are in flight, the message is then dropped.
+    bool postInterrupt(word_t message) { return m_postedInterrupts.post(message); }
 
-    template<typename HardwareType> void addDevice();
+    template<typename HardwareType> HardwareType* addDevice();
 
     void printRegisters() const;
 
     cycles_t getCycles() const { return m_cycles; }
+    uint64_t getInstructionCount() const { return m_instructionCount; } // skipped idle loops excluded
+    TimingMode getTimingMode() const { return m_timing; }
     word_t getPC() const { return m_pc; }
     word_t getSP() const { return m_sp; }
     word_t getEX() const { return m_ex; }
     word_t getIA() const { return m_ia; }
+    bool isOnFire() const { return m_isOnFire; }
     word_t getRegister(Registers r) const { return m_registers[r]; }
+    long_t getPCLimit() const { return m_pcLimit; }
 
     void setPC(word_t v) { m_pc = v; }
     void setSP(word_t v) { m_sp = v; }
     void setRegister(Registers r, word_t v) { m_registers[r] = v; }
+    void setPCLimit(long_t limit) { m_pcLimit = limit; }
+    void addBreakpoint(word_t addr);
+    void removeBreakpoint(word_t addr);
+    void setDecodeCacheEnabled(bool enabled) { m_useDecodeCache = enabled; }
+    void setPeepholeEnabled(bool enabled);
+
+    void setEngine(EngineType type);
+    EngineType getEngine() const { return m_engineType; }
 
 private:
+    friend class ThreadedEngine;
+    friend class SpecializedEngine;
+    friend class BlockEngine;
+    friend class JitEngine;
+    friend class LockstepBatch;
+    friend class Snapshot;
+
+    template<typename Predicate> StopReason runLoop(Memory& mem, cycles_t budget, bool singleStep,
+                                                    Predicate& predicate);
+    bool advance(Memory& mem, long_t maxInstructions, cycles_t maxCycles);
+    long_t runEngine(Memory& mem, long_t maxInstructions, cycles_t maxCycles);
+    void interpret(Memory& mem);
+    bool processInterrupts(Memory& mem);
+    void queueInterrupt(word_t message);
+    void receivePostedInterrupts();
+    void setInterruptQueueActive(bool active);
+    void attachDevice(Hardware* device);
+    void scheduleDevice(deviceIdx_t deviceIndex);
+    void updateDevices(Memory& mem);
+    cycles_t cyclesUntilNextEvent() const;
+    bool skipIdleLoop(Memory& mem, cycles_t maxCycles);
+    bool findIdleLoop(Memory& mem, cycles_t& outCycles);
     word_t* getAddrPtr(Memory& mem, bool isA, Value v, word_t& extraWord, cycles_t& inOutCycles);
     cycles_t eval(Memory& mem, Instruction& nextInstruction);
+    template<TimingMode Mode> cycles_t eval(Memory& mem, Instruction& nextInstruction);
+    word_t getSkipTarget(Memory& mem, word_t& outSkippedCount);
+    void push(Memory& mem, word_t value);
 
+    TimingMode m_timing = TimingMode_CycleAccurate;
     cycles_t m_cycles = 0;
+    uint64_t m_instructionCount = 0;
     word_t m_pc = 0;
     word_t m_sp = 0;
     word_t m_ex = 0;
     word_t m_ia = 0;
     word_t m_registers[Registers_Count];
+    long_t m_pcLimit = NoPCLimit;     // engine batches stop when pc reaches it
+    struct ScheduledEvent {
+        cycles_t m_cycle;
+        deviceIdx_t m_device;
+    };
+    struct EventAfter {             // min-heap order, wrap safe for events within 2^31 cycles
+        bool operator()(const ScheduledEvent& lhs, const ScheduledEvent& rhs) const {
+            return static_cast<int32_t>(lhs.m_cycle - rhs.m_cycle) > 0;
+        }
+    };
+
     vector<Hardware*> m_devices;
-    queue<word_t> m_queuedInterrupts;
+    vector<cycles_t> m_deviceEvents;  // cycle each device is scheduled at, heap entries differing are stale
+    std::priority_queue<ScheduledEvent, vector<ScheduledEvent>, EventAfter> m_events;
+    cycles_t m_idleCheckCycles = 0;
+    // Interrupt queue, plain data like the registers that Snapshot saves and
+    // restores. The DCPU itself is not copyable, it owns its devices, engine
+    // and decode cache, copies of a machine go through Snapshot or reset.
+    word_t m_queuedInterrupts[InterruptQueueSize];  // ring buffer
+    byte_t m_queueHead = 0;                         // wraps with the ring
+    word_t m_queueSize = 0;
     bool m_isInterruptQueueActive = false;
+    bool m_isInterruptPending = false;              // queued and deliverable now
+    bool m_isOnFire = false;                        // latched by a queue overflow
+    InterruptChannel m_postedInterrupts;
+    vector<bool> m_breakpoints;       // keyed by address, allocated by the first addBreakpoint
+    long_t m_breakpointCount = 0;
+    bool m_useDecodeCache = true;
+    bool m_usePeephole = true;
+    DecodeCache m_decodeCache;
+    EngineType m_engineType = EngineType_Switch;
+    std::unique_ptr<ExecutionEngine> m_engine;
 };
 
 template<typename HardwareType>
-void DCPU::addDevice(){
+HardwareType* DCPU::addDevice(){
     dcpu_assert_fmt(m_devices.size() < 0x10000, "Trying to add to many devices: %d", m_devices.size());
     
     HardwareType* device = new HardwareType{};
-    device->init(m_devices.size());
-    m_devices.push_back(device);
+    attachDevice(device);
+    return device;
+}
+
+template<typename Predicate>
+StopReason DCPU::runUntil(Memory& mem, Predicate predicate, cycles_t budget) {
+    return runLoop(mem, budget, true, predicate);
+}
+
+template<typename Predicate>
+StopReason DCPU::runLoop(Memory& mem, cycles_t budget, bool singleStep, Predicate& predicate) {
+    const cycles_t start = m_cycles;
+    bool isFirst = true;
+    while (true) {
+        if (m_isOnFire) {
+            return StopReason_OnFire;
+        }
+        if (m_pc >= m_pcLimit) {
+            return StopReason_PCLimit;
+        }
+        const cycles_t elapsed = m_cycles - start;
+        if (elapsed >= budget) {
+            return StopReason_Budget;
+        }
+        if (m_breakpointCount != 0 && !isFirst && m_breakpoints[m_pc]) {
+            return StopReason_Breakpoint;
+        }
+        isFirst = false;
+
+        long_t batch = 1;
+        cycles_t batchCycles = NoCycleBudget;
+        if (!singleStep && m_breakpointCount == 0) {
+            cycles_t horizon = cyclesUntilNextEvent();
+            if (budget != NoCycleBudget) {
+                horizon = std::min(horizon, budget - elapsed);
+            }
+            if (skipIdleLoop(mem, horizon)) {
+                continue;
+            }
+            // the batch stops on the instruction reaching the horizon, where
+            // the device event or the end of the budget is seen
+            batch = RunBatchSize;
+            batchCycles = std::max<cycles_t>(horizon, 1);
+        }
+        if (advance(mem, batch, batchCycles)) {
+            return StopReason_Interrupt;
+        }
+        if (predicate(static_cast<const DCPU&>(*this))) {
+            return StopReason_Predicate;
+        }
+    }
 }